@@ -0,0 +1,97 @@
+#include <dirent.h>
+#include <algorithm>
+#include <cstring>
+
+#include "artifact_catalog.h"
+#include "gadget_cache.h"
+#include "log.h"
+
+bool parse_gadget_name(std::string_view name, GadgetArtifact& artifact) {
+    static constexpr struct {
+        std::string_view suffix;
+        GadgetAbi abi;
+    } suffixes[] = {
+            {"arm.so", GadgetAbi::arm},
+            {"arm64.so", GadgetAbi::arm64},
+            {"x86.so", GadgetAbi::x86},
+            {"x86_64.so", GadgetAbi::x86_64},
+    };
+    bool compressed = name.ends_with(GADGET_COMPRESSED_SUFFIX);
+    std::string_view plain = name.substr(0, name.size() - (compressed ? strlen(GADGET_COMPRESSED_SUFFIX) : 0));
+    for (const auto& [suffix, abi] : suffixes) {
+        if (!plain.ends_with(suffix)) continue;
+        std::string_view stem = plain.substr(0, plain.size() - suffix.size());
+        size_t infix = stem.find("-gadget");
+        if (infix == std::string_view::npos) return false;
+
+        artifact.name = name;
+        artifact.abi = abi;
+        artifact.compressed = compressed;
+        std::fill(std::begin(artifact.version), std::end(artifact.version), 0);
+        std::string_view rest = stem.substr(infix + 7);
+        size_t pos = rest.find_first_of("0123456789");
+        for (int part = 0; part < GADGET_VERSION_PARTS && pos < rest.size(); part++) {
+            uint value = 0;
+            while (pos < rest.size() && rest[pos] >= '0' && rest[pos] <= '9') {
+                value = value * 10 + (rest[pos++] - '0');
+            }
+            artifact.version[part] = value;
+            if (pos + 1 >= rest.size() || rest[pos] != '.' || rest[pos + 1] < '0' || rest[pos + 1] > '9') break;
+            pos++;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool is_gadget_config_name(std::string_view name) {
+    return name.ends_with("-gadget.config");
+}
+
+// The config and its lock and temporary files come and go on every update, they do not count
+static bool is_artifact_name(std::string_view name) {
+    GadgetArtifact artifact;
+    return is_gadget_config_name(name) || parse_gadget_name(name, artifact);
+}
+
+void ArtifactCatalog::scan_locked() {
+    gadgets.clear();
+    configs.clear();
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) return;
+    while (auto entry = readdir(d)) {
+        std::string_view name = entry->d_name;
+        GadgetArtifact artifact;
+        if (parse_gadget_name(name, artifact)) {
+            gadgets.push_back(std::move(artifact));
+        } else if (is_gadget_config_name(name)) {
+            configs.emplace_back(name);
+        }
+    }
+    closedir(d);
+    std::sort(gadgets.begin(), gadgets.end(), [](const GadgetArtifact& a, const GadgetArtifact& b) {
+        if (a.abi != b.abi) return a.abi < b.abi;
+        if (!std::equal(std::begin(a.version), std::end(a.version), std::begin(b.version))) {
+            return std::lexicographical_compare(std::begin(b.version), std::end(b.version),
+                                                std::begin(a.version), std::end(a.version));
+        }
+        if (a.compressed != b.compressed) return b.compressed;
+        return a.name < b.name;
+    });
+    std::sort(configs.begin(), configs.end());
+    LOGD("Catalog of %s: %zu gadgets, %zu configs", dir.c_str(), gadgets.size(), configs.size());
+}
+
+ArtifactSelection ArtifactCatalog::lookup(const std::string& module_dir, GadgetAbi abi) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (watch.changed(module_dir, is_artifact_name)) {
+        dir = module_dir;
+        scan_locked();
+    }
+
+    ArtifactSelection selection;
+    auto gadget = std::find_if(gadgets.begin(), gadgets.end(), [abi](const GadgetArtifact& a) { return a.abi == abi; });
+    if (gadget != gadgets.end()) selection.gadget = gadget->name;
+    if (!configs.empty()) selection.config = configs.front();
+    return selection;
+}
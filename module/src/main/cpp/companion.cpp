@@ -0,0 +1,407 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "artifact_catalog.h"
+#include "companion.h"
+#include "config_parser.h"
+#include "control.h"
+#include "file_util.h"
+#include "gadget_cache.h"
+#include "log.h"
+#include "package_table.h"
+#include "process_matcher.h"
+
+#define BUFFER_SIZE 1024
+
+void writeString(int fd, const std::string& str) {
+    size_t length = str.size() + 1;
+    write(fd, &length, sizeof(length));
+    write(fd, str.c_str(), length);
+}
+
+std::string readString(int fd) {
+    size_t length = 0;
+    if (read(fd, &length, sizeof(length)) != sizeof(length) || length == 0 || length > PATH_MAX) return {};
+    std::vector<char> buffer(length);
+    if (read(fd, buffer.data(), length) != (ssize_t) length) return {};
+    buffer.back() = '\0';
+    return {buffer.data()};
+}
+
+void sendFd(int sock, int fd) {
+    char dummy = 0;
+    struct iovec iov = {&dummy, sizeof(dummy)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    sendmsg(sock, &msg, 0);
+}
+
+int recvFd(int sock) {
+    char dummy;
+    struct iovec iov = {&dummy, sizeof(dummy)};
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(sock, &msg, 0) <= 0) return -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) return -1;
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+static std::mutex config_lock;
+static GadgetConfig last_good_config;
+static bool has_last_good_config = false;
+// The config file as it was when last parsed, valid or not. Until it changes the file is not read.
+static struct stat last_config_stat;
+static bool has_last_config_stat = false;
+
+// While subscribed to zygisk-gadget daemon its snapshots replace reading the file
+static bool subscribed = false;
+static bool has_pushed_config = false;
+static time_t last_subscribe_attempt = 0;
+
+static bool parse_snapshot(const char *snapshot, GadgetConfig& config) {
+    unsigned long long generation;
+    int config_mode, profile, end = 0;
+    if (sscanf(snapshot, CONTROL_SNAPSHOT_FORMAT, &generation, config.package_name, &config.delay, &config_mode,
+               &profile, &end) != 5) {
+        return false;
+    }
+    const char *rules = snapshot + end;
+    while (*rules == ' ') rules++;
+    if (!set_process_rules(config, rules)) return false;
+    config.config_mode = config_mode != 0;
+    config.profile = profile != 0;
+    config.generation = generation;
+    config.has_generation = true;
+    return true;
+}
+
+static void subscriber_loop(int fd) {
+    char buf[CONTROL_LINE_MAX * 4];
+    size_t len = 0;
+    while (true) {
+        ssize_t n = read(fd, buf + len, sizeof(buf) - len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        len += n;
+        buf[len] = '\0';
+        char *line = buf, *end;
+        while ((end = strchr(line, '\n')) != nullptr) {
+            *end = '\0';
+            GadgetConfig config;
+            if (strncmp(line, "snapshot ", 9) == 0 && parse_snapshot(line + 9, config)) {
+                std::lock_guard<std::mutex> guard(config_lock);
+                last_good_config = config;
+                has_last_good_config = true;
+                has_pushed_config = true;
+                LOGD("Config generation %llu pushed", (unsigned long long) config.generation);
+            }
+            line = end + 1;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+        if (len == sizeof(buf) - 1) len = 0;
+    }
+    close(fd);
+    std::lock_guard<std::mutex> guard(config_lock);
+    subscribed = false;
+    has_pushed_config = false;
+}
+
+// Connects to the daemon if it runs, at most once per second. Called with config_lock held.
+static void try_subscribe() {
+    struct timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (subscribed || now.tv_sec == last_subscribe_attempt) return;
+    last_subscribe_attempt = now.tv_sec;
+    int fd = control_connect();
+    if (fd < 0) return;
+    // Abstract sockets have no file permissions, only take configs from a daemon run by root
+    struct ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != 0) {
+        close(fd);
+        return;
+    }
+    const char request[] = "subscribe\n";
+    if (send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != sizeof(request) - 1) {
+        close(fd);
+        return;
+    }
+    subscribed = true;
+    std::thread(subscriber_loop, fd).detach();
+}
+
+// The current config, or the last one that was valid
+static bool read_config(const std::string& path, GadgetConfig& config) {
+    // Taken before reading, a change while reading is seen by the next call
+    struct stat st{};
+    bool has_stat = stat(path.c_str(), &st) == 0;
+    {
+        std::lock_guard<std::mutex> guard(config_lock);
+        try_subscribe();
+        if (has_pushed_config) {
+            config = last_good_config;
+            return true;
+        }
+        if (has_stat && has_last_config_stat && same_file(st, last_config_stat)) {
+            if (!has_last_good_config) return false;
+            config = last_good_config;
+            return true;
+        }
+    }
+    GadgetConfig parsed;
+    ConfigStatus status = read_gadget_config(path.c_str(), parsed);
+    bool ok = (bool) status;
+    if (!ok) {
+        LOGE("Config %s: %s%s%s at offset %zu", path.c_str(), config_error_string(status.error),
+             status.field != nullptr ? " " : "", status.field != nullptr ? status.field : "", status.offset);
+    }
+    std::lock_guard<std::mutex> guard(config_lock);
+    last_config_stat = st;
+    has_last_config_stat = has_stat;
+    if (ok && has_last_good_config && parsed.has_generation && parsed.generation < last_good_config.generation) {
+        LOGD("Ignoring config generation %llu, already saw %llu", (unsigned long long) parsed.generation,
+             (unsigned long long) last_good_config.generation);
+        ok = false;
+    }
+    if (ok) {
+        last_good_config = parsed;
+        has_last_good_config = true;
+    } else if (has_last_good_config) {
+        LOGD("Invalid config %s, keeping generation %llu", path.c_str(),
+             (unsigned long long) last_good_config.generation);
+    }
+    if (!has_last_good_config) return false;
+    config = last_good_config;
+    return true;
+}
+
+static bool copy_file(const char *source_path, const char *dest_path) {
+    FILE *source_file, *dest_file;
+    char buffer[BUFFER_SIZE];
+    size_t bytes_read;
+
+    source_file = fopen(source_path, "rbe");
+    if (source_file == nullptr) {
+        LOGD("Error opening source file %s", source_path);
+        return false;
+    }
+
+    dest_file = fopen(dest_path, "wbe");
+    if (dest_file == nullptr) {
+        LOGD("Error opening destination file %s", dest_path);
+        fclose(source_file);
+        return false;
+    }
+
+    bool ok = true;
+    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, source_file)) > 0) {
+        if (fwrite(buffer, 1, bytes_read, dest_file) != bytes_read) {
+            LOGD("Error writing to destination file %s", dest_path);
+            ok = false;
+            break;
+        }
+    }
+
+    if (ok && ferror(source_file)) {
+        LOGD("Error reading from source file %s", source_path);
+        ok = false;
+    }
+
+    fclose(source_file);
+    if (fclose(dest_file) != 0) ok = false;
+    return ok;
+}
+
+static bool copy_gadget_fd(int fd, const char *dest_path) {
+    struct stat st{};
+    if (fstat(fd, &st) != 0) return false;
+    int dest = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (dest < 0) {
+        LOGD("Error opening destination file");
+        return false;
+    }
+    bool ok = copy_fd(dest, fd, st.st_size);
+    if (!ok) LOGD("Error writing to destination file");
+    close(dest);
+    return ok;
+}
+
+// Only constructed in the companion
+static ArtifactCatalog& artifact_catalog() {
+    static ArtifactCatalog catalog;
+    return catalog;
+}
+
+static GadgetCache& gadget_cache() {
+    static GadgetCache cache;
+    return cache;
+}
+
+static InstalledPackages& installed_packages() {
+    static InstalledPackages packages;
+    return packages;
+}
+
+// What serving a fork takes from one config. Immutable once built, so the connections of a boot
+// storm share it without holding a lock while they match.
+struct TargetPlan {
+    GadgetConfig config;
+    ProcessMatcher matcher;
+};
+
+static bool same_target(const GadgetConfig& a, const GadgetConfig& b) {
+    return a.generation == b.generation && strcmp(a.package_name, b.package_name) == 0 &&
+           strcmp(a.process_rules, b.process_rules) == 0 && a.delay == b.delay &&
+           a.config_mode == b.config_mode && a.profile == b.profile;
+}
+
+// The plan of config, built again only when the config changed
+static std::shared_ptr<const TargetPlan> target_plan(const GadgetConfig& config) {
+    static std::mutex lock;
+    static std::shared_ptr<const TargetPlan> current;
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (current != nullptr && same_target(current->config, config)) return current;
+
+    auto plan = std::make_shared<TargetPlan>();
+    plan->config = config;
+    // Without rules only the main process, like before they existed
+    if (config.process_rules[0] == '\0' || !plan->matcher.compile(config.process_rules, config.package_name)) {
+        if (config.process_rules[0] != '\0') {
+            LOGE("Process rules invalid or too complex, only injecting %s: %s", config.package_name, config.process_rules);
+        }
+        plan->matcher.compile(config.package_name, config.package_name);
+    }
+    current = plan;
+    return current;
+}
+
+// What the target is sent once it is told to inject
+struct GadgetDelivery {
+    std::string gadget_name;  // as loaded, without GADGET_COMPRESSED_SUFFIX
+    std::string config_name;  // of the frida-gadget config copied to the app data dir, empty if none
+    int fd = -1;              // the gadget, -1 if it was copied to the app data dir instead
+};
+
+// Done before the target is told to inject, so a target that cannot get a gadget is not injected
+static bool prepare_gadget(const std::string& module_dir, const GadgetConfig& config, GadgetDelivery& delivery) {
+    ArtifactSelection artifacts = artifact_catalog().lookup(module_dir, GADGET_NATIVE_ABI);
+    if (artifacts.gadget.empty()) {
+        LOGE("No frida-gadget for this ABI in %s", module_dir.c_str());
+        return false;
+    }
+    std::string frida_gadget_path = module_dir + "/" + artifacts.gadget;
+    // A compressed gadget is loaded under its name without .xz
+    delivery.gadget_name = artifacts.gadget;
+    if (delivery.gadget_name.ends_with(GADGET_COMPRESSED_SUFFIX)) {
+        delivery.gadget_name.resize(delivery.gadget_name.size() - strlen(GADGET_COMPRESSED_SUFFIX));
+    }
+    std::string data_dir = std::string("/data/data/") + config.package_name + "/";
+
+    // The target removes the config copy once the gadget has loaded, so it is told its name
+    if (config.config_mode && !artifacts.config.empty()) {
+        delivery.config_name = delivery.gadget_name.substr(0, delivery.gadget_name.find_last_of('.')) + ".config.so";
+        std::string copy_src = module_dir + "/" + artifacts.config;
+        if (!copy_file(copy_src.c_str(), (data_dir + delivery.config_name).c_str())) {
+            LOGE("Cannot copy %s to %s, not injecting", copy_src.c_str(), data_dir.c_str());
+            return false;
+        }
+    }
+
+    int gadget_fd = gadget_cache().get(frida_gadget_path);
+    // frida-gadget looks for its config next to itself, so config mode keeps the file copy
+    if (gadget_fd >= 0 && !config.config_mode) {
+        delivery.fd = gadget_fd;
+        return true;
+    }
+
+    std::string copy_dst = data_dir + delivery.gadget_name;
+    bool copied;
+    if (gadget_fd >= 0) {
+        copied = copy_gadget_fd(gadget_fd, copy_dst.c_str());
+        close(gadget_fd);
+    } else {
+        // Without the cache only an uncompressed gadget can be copied as it is
+        copied = delivery.gadget_name == artifacts.gadget && copy_file(frida_gadget_path.c_str(), copy_dst.c_str());
+    }
+    if (!copied) LOGE("Cannot provide %s to %s, not injecting", artifacts.gadget.c_str(), config.package_name);
+    return copied;
+}
+
+void companion_handler(int i) {
+    std::string config_file_path = readString(i);
+    int uid = -1;
+    read(i, &uid, sizeof(uid));
+
+    GadgetConfig current_config;
+    if (!read_config(config_file_path, current_config)) {
+        // The module always waits for a target name
+        writeString(i, "");
+        return;
+    }
+    std::shared_ptr<const TargetPlan> plan = target_plan(current_config);
+    const GadgetConfig& config = plan->config;
+    // Processes of other apps are told there is no target. Without packages.list every process
+    // gets the name, to be compared by the module like before. Isolated processes cannot be told
+    // apart by uid, the process rules only accept names of the target package for them.
+    int app_id = installed_packages().app_id(config.package_name);
+    int uid_app_id = uid % AID_USER_OFFSET;
+    bool isolated = uid_app_id >= AID_ISOLATED_START && uid_app_id <= AID_ISOLATED_END;
+    if (app_id >= 0 && uid_app_id != app_id && !isolated) {
+        writeString(i, "");
+        return;
+    }
+    std::string target_package_name = config.package_name;
+    uint delay = config.delay;
+    bool profile_mode = config.profile;
+
+    writeString(i, target_package_name);
+
+    std::string process_name = readString(i);
+    bool enable_gadget_injection = !process_name.empty() && plan->matcher.matches(process_name);
+    std::string module_dir = config_file_path.substr(0, config_file_path.rfind('/'));
+    GadgetDelivery delivery;
+    if (enable_gadget_injection) enable_gadget_injection = prepare_gadget(module_dir, config, delivery);
+    write(i, &enable_gadget_injection, sizeof(enable_gadget_injection));
+    if (!enable_gadget_injection) {
+        return;
+    }
+
+    write(i, &delay, sizeof(delay));
+    write(i, &profile_mode, sizeof(profile_mode));
+    writeString(i, delivery.gadget_name);
+    writeString(i, delivery.config_name);
+    bool has_gadget_fd = delivery.fd >= 0;
+    write(i, &has_gadget_fd, sizeof(has_gadget_fd));
+    if (has_gadget_fd) {
+        sendFd(i, delivery.fd);
+        close(delivery.fd);
+    }
+}
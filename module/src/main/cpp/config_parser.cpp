@@ -0,0 +1,569 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+#include "config_parser.h"
+
+#define CONFIG_MAX_SIZE (16 * 1024)
+#define CONFIG_MAX_DEPTH 32
+#define CONFIG_SCHEMA_DEPTH 4
+
+namespace {
+
+enum class FieldType : uint8_t {
+    string,
+    uint32,
+    uint64,
+    boolean,
+};
+
+struct FieldSpec {
+    std::string_view name;  // dotted path from the top level object
+    FieldType type;
+    bool required;
+    size_t offset;          // of the member of GadgetConfig
+    size_t size;
+};
+
+#define CONFIG_FIELD(path, type, required, member) \
+    {path, FieldType::type, required, offsetof(GadgetConfig, member), sizeof(GadgetConfig::member)}
+
+// The config layout, in the order it is written. Parsing and formatting are both driven by it.
+constexpr FieldSpec config_schema[] = {
+        CONFIG_FIELD("package.name", string, true, package_name),
+        CONFIG_FIELD("package.delay", uint32, true, delay),
+        CONFIG_FIELD("package.process", string, false, process_rules),
+        CONFIG_FIELD("package.mode.config", boolean, true, config_mode),
+        CONFIG_FIELD("package.mode.profile", boolean, false, profile),
+        CONFIG_FIELD("generation", uint64, false, generation),
+};
+
+constexpr int FIELD_COUNT = std::size(config_schema);
+
+struct FieldPath {
+    std::string_view keys[CONFIG_SCHEMA_DEPTH];
+    int depth;
+};
+
+// The keys of every field, split at compile time
+constexpr auto field_paths = [] {
+    std::array<FieldPath, FIELD_COUNT> paths{};
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        std::string_view name = config_schema[i].name;
+        while (true) {
+            size_t dot = name.find('.');
+            paths[i].keys[paths[i].depth++] = name.substr(0, dot);
+            if (dot == std::string_view::npos) break;
+            name.remove_prefix(dot + 1);
+        }
+    }
+    return paths;
+}();
+
+constexpr int common_prefix(const FieldPath &a, const FieldPath &b) {
+    int n = 0;
+    while (n < a.depth - 1 && n < b.depth - 1 && a.keys[n] == b.keys[n]) n++;
+    return n;
+}
+
+constexpr bool is_prefix(const FieldPath &prefix, const FieldPath &path) {
+    if (prefix.depth > path.depth) return false;
+    for (int i = 0; i < prefix.depth; i++) {
+        if (prefix.keys[i] != path.keys[i]) return false;
+    }
+    return true;
+}
+
+constexpr bool valid_schema() {
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const FieldSpec &field = config_schema[i];
+        if (field.type == FieldType::uint32 && field.size != sizeof(uint32_t)) return false;
+        if (field.type == FieldType::uint64 && field.size != sizeof(uint64_t)) return false;
+        if (field.type == FieldType::boolean && field.size != sizeof(bool)) return false;
+        for (int j = 0; j < FIELD_COUNT; j++) {
+            // A field cannot be an object of other fields, nor appear twice
+            if (i != j && is_prefix(field_paths[i], field_paths[j])) return false;
+            // format_gadget_config() opens every object once: the fields of an object are adjacent
+            for (int k = i + 1; k < j; k++) {
+                if (common_prefix(field_paths[i], field_paths[k]) < common_prefix(field_paths[i], field_paths[j])) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(FIELD_COUNT <= 32, "fields are tracked in a 32 bit mask");
+static_assert(valid_schema(), "config_schema is inconsistent");
+
+constexpr uint ALL_FIELDS = (1ull << FIELD_COUNT) - 1;
+
+constexpr uint REQUIRED_FIELDS = [] {
+    uint mask = 0;
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (config_schema[i].required) mask |= 1u << i;
+    }
+    return mask;
+}();
+
+constexpr int field_index(std::string_view name) {
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (config_schema[i].name == name) return i;
+    }
+    return -1;
+}
+
+constexpr int GENERATION_FIELD = field_index("generation");
+static_assert(GENERATION_FIELD >= 0);
+
+// Decoded string characters, counted past the capacity so an overlong value is detected
+struct StringSink {
+    char *buf;
+    size_t capacity;
+    size_t length = 0;
+
+    void push_back(char c) {
+        if (length < capacity) buf[length] = c;
+        length++;
+    }
+};
+
+// Recursive descent over the JSON text. The fields still possible at the current path are tracked
+// as a mask of config_schema, values outside of it are validated and skipped.
+struct ConfigParser {
+    const char *begin;
+    const char *p;
+    const char *end;
+    GadgetConfig &config;
+    uint seen = 0;
+    ConfigStatus status{};
+
+    bool fail(ConfigError error, int field = -1) {
+        if (status.error == ConfigError::none) {
+            status.error = error;
+            status.offset = p - begin;
+            status.field = field >= 0 ? config_schema[field].name.data() : nullptr;
+        }
+        return false;
+    }
+
+    template<typename T>
+    T &member(int field) {
+        return *reinterpret_cast<T *>(reinterpret_cast<char *>(&config) + config_schema[field].offset);
+    }
+
+    void skip_space() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if (p == end || *p != c) return false;
+        p++;
+        return true;
+    }
+
+    bool literal(std::string_view word) {
+        if ((size_t) (end - p) < word.size() || memcmp(p, word.data(), word.size()) != 0) return false;
+        p += word.size();
+        return true;
+    }
+
+    static int hex(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    bool hex4(uint &code) {
+        if (end - p < 4) return false;
+        code = 0;
+        for (int i = 0; i < 4; i++) {
+            int digit = hex(*p++);
+            if (digit < 0) return false;
+            code = code << 4 | digit;
+        }
+        return true;
+    }
+
+    static void put_utf8(StringSink &out, uint code) {
+        if (code < 0x80) {
+            out.push_back((char) code);
+        } else if (code < 0x800) {
+            out.push_back((char) (0xc0 | code >> 6));
+            out.push_back((char) (0x80 | (code & 0x3f)));
+        } else if (code < 0x10000) {
+            out.push_back((char) (0xe0 | code >> 12));
+            out.push_back((char) (0x80 | (code >> 6 & 0x3f)));
+            out.push_back((char) (0x80 | (code & 0x3f)));
+        } else {
+            out.push_back((char) (0xf0 | code >> 18));
+            out.push_back((char) (0x80 | (code >> 12 & 0x3f)));
+            out.push_back((char) (0x80 | (code >> 6 & 0x3f)));
+            out.push_back((char) (0x80 | (code & 0x3f)));
+        }
+    }
+
+    // A string after its opening quote. Decoded into out if it is not null.
+    bool string(StringSink *out) {
+        while (p < end) {
+            char c = *p++;
+            if (c == '"') return true;
+            if ((unsigned char) c < 0x20) return false;
+            if (c != '\\') {
+                if (out != nullptr) out->push_back(c);
+                continue;
+            }
+            if (p == end) return false;
+            c = *p++;
+            switch (c) {
+                case '"': case '\\': case '/': break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'u': {
+                    uint code;
+                    if (!hex4(code)) return false;
+                    if (code >= 0xd800 && code <= 0xdbff) {
+                        uint low;
+                        if (end - p < 2 || p[0] != '\\' || p[1] != 'u') return false;
+                        p += 2;
+                        if (!hex4(low) || low < 0xdc00 || low > 0xdfff) return false;
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    } else if (code >= 0xdc00 && code <= 0xdfff) {
+                        return false;
+                    }
+                    if (out != nullptr) put_utf8(*out, code);
+                    continue;
+                }
+                default:
+                    return false;
+            }
+            if (out != nullptr) out->push_back(c);
+        }
+        return false;
+    }
+
+    // A key after its opening quote, compared without unescaping
+    bool key(std::string_view &out) {
+        const char *start = p;
+        if (!string(nullptr)) return false;
+        out = std::string_view(start, p - 1 - start);
+        return true;
+    }
+
+    // A number, returned in value if it is an unsigned integer
+    bool number(uint64_t *value, bool *is_unsigned) {
+        const char *start = p;
+        if (p < end && *p == '-') p++;
+        if (p == end || *p < '0' || *p > '9') return false;
+        uint64_t result = 0;
+        bool overflow = false;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (result > (UINT64_MAX - (*p - '0')) / 10) overflow = true;
+            result = result * 10 + (*p++ - '0');
+        }
+        bool integer = true;
+        if (p < end && *p == '.') {
+            integer = false;
+            p++;
+            if (p == end || *p < '0' || *p > '9') return false;
+            while (p < end && *p >= '0' && *p <= '9') p++;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            integer = false;
+            p++;
+            if (p < end && (*p == '+' || *p == '-')) p++;
+            if (p == end || *p < '0' || *p > '9') return false;
+            while (p < end && *p >= '0' && *p <= '9') p++;
+        }
+        *is_unsigned = integer && !overflow && *start != '-';
+        *value = result;
+        return true;
+    }
+
+    // The fields of candidates below key at depth
+    static uint children(uint candidates, int depth, std::string_view key) {
+        uint result = 0;
+        for (int i = 0; i < FIELD_COUNT; i++) {
+            if ((candidates >> i & 1) && field_paths[i].depth > depth && field_paths[i].keys[depth] == key) {
+                result |= 1u << i;
+            }
+        }
+        return result;
+    }
+
+    // The field of candidates that ends at depth, -1 if none
+    static int leaf(uint candidates, int depth) {
+        for (int i = 0; i < FIELD_COUNT; i++) {
+            if ((candidates >> i & 1) && field_paths[i].depth == depth) return i;
+        }
+        return -1;
+    }
+
+    // A value of our field that does not have its type. Optional fields are ignored like a missing
+    // one, the value is skipped then.
+    bool mismatch(int field, int depth) {
+        if (config_schema[field].required) return fail(ConfigError::wrong_type, field);
+        return value(0, depth);
+    }
+
+    bool field_value(int field, int depth) {
+        const FieldSpec &spec = config_schema[field];
+        seen &= ~(1u << field);
+        char c = *p;
+        if (c == 'n') {
+            // Unset, which makes a required field missing
+            return literal("null");
+        }
+        switch (spec.type) {
+            case FieldType::string: {
+                if (c != '"') return mismatch(field, depth);
+                p++;
+                const char *start = p;
+                StringSink sink{&member<char>(field), spec.size - 1};
+                if (!string(&sink)) return false;
+                if (sink.length > sink.capacity) {
+                    p = start;
+                    return fail(ConfigError::out_of_range, field);
+                }
+                (&member<char>(field))[sink.length] = '\0';
+                break;
+            }
+            case FieldType::boolean: {
+                if (c != 't' && c != 'f') return mismatch(field, depth);
+                if (!literal(c == 't' ? "true" : "false")) return false;
+                member<bool>(field) = c == 't';
+                break;
+            }
+            case FieldType::uint32:
+            case FieldType::uint64: {
+                if (c != '-' && (c < '0' || c > '9')) return mismatch(field, depth);
+                const char *start = p;
+                uint64_t number_value;
+                bool is_unsigned;
+                if (!number(&number_value, &is_unsigned)) return false;
+                bool fits = is_unsigned && (spec.type == FieldType::uint64 || number_value <= UINT_MAX);
+                if (!fits) {
+                    if (!spec.required) return true;
+                    // A negative or fractional number is another type to nlohmann, which wrote the file
+                    bool integer = std::none_of(start, p, [](char d) { return d == '.' || d == 'e' || d == 'E'; });
+                    bool negative = *start == '-';
+                    p = start;
+                    return fail(integer && !negative ? ConfigError::out_of_range : ConfigError::wrong_type, field);
+                }
+                if (spec.type == FieldType::uint32) {
+                    member<uint32_t>(field) = (uint32_t) number_value;
+                } else {
+                    member<uint64_t>(field) = number_value;
+                }
+                break;
+            }
+        }
+        seen |= 1u << field;
+        return true;
+    }
+
+    bool value(uint candidates, int depth) {
+        skip_space();
+        if (p == end) return false;
+        if (depth > CONFIG_MAX_DEPTH) return fail(ConfigError::too_deep);
+        int field = leaf(candidates, depth);
+        if (field >= 0) return field_value(field, depth);
+        char c = *p;
+        if (c == '{') {
+            p++;
+            if (consume('}')) return true;
+            do {
+                std::string_view name;
+                if (!consume('"') || !key(name) || !consume(':')) return false;
+                uint below = candidates != 0 ? children(candidates, depth, name) : 0;
+                if (!value(below, depth + 1)) return false;
+            } while (consume(','));
+            return consume('}');
+        }
+        if (c == '[') {
+            p++;
+            if (consume(']')) return true;
+            do {
+                // Array elements are never ours
+                if (!value(0, depth + 1)) return false;
+            } while (consume(','));
+            return consume(']');
+        }
+        if (c == '"') {
+            p++;
+            return string(nullptr);
+        }
+        if (c == 't') return literal("true");
+        if (c == 'f') return literal("false");
+        if (c == 'n') return literal("null");
+        uint64_t number_value;
+        bool is_unsigned;
+        return number(&number_value, &is_unsigned);
+    }
+};
+
+// Appends to a fixed buffer, counting what does not fit
+struct ConfigWriter {
+    char *buf;
+    size_t size;
+    size_t length = 0;
+
+    void put(std::string_view text) {
+        if (length < size) memcpy(buf + length, text.data(), std::min(text.size(), size - length));
+        length += text.size();
+    }
+
+    void indent(int level) {
+        for (int i = 0; i < level; i++) put("    ");
+    }
+
+    void quoted(std::string_view text) {
+        put("\"");
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                char escaped[] = {'\\', c};
+                put(std::string_view(escaped, 2));
+            } else if ((unsigned char) c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) c);
+                put(escaped);
+            } else {
+                put(std::string_view(&c, 1));
+            }
+        }
+        put("\"");
+    }
+
+    template<typename T>
+    const T &member(const GadgetConfig &config, int field) {
+        return *reinterpret_cast<const T *>(reinterpret_cast<const char *>(&config) + config_schema[field].offset);
+    }
+
+    void field_value(const GadgetConfig &config, int field) {
+        char number[24];
+        switch (config_schema[field].type) {
+            case FieldType::string:
+                quoted(&member<char>(config, field));
+                break;
+            case FieldType::boolean:
+                put(member<bool>(config, field) ? "true" : "false");
+                break;
+            case FieldType::uint32:
+                snprintf(number, sizeof(number), "%u", member<uint32_t>(config, field));
+                put(number);
+                break;
+            case FieldType::uint64:
+                snprintf(number, sizeof(number), "%llu", (unsigned long long) member<uint64_t>(config, field));
+                put(number);
+                break;
+        }
+    }
+};
+
+}
+
+const char *config_error_string(ConfigError error) {
+    switch (error) {
+        case ConfigError::none: return "no error";
+        case ConfigError::io: return "cannot be read";
+        case ConfigError::too_large: return "too large";
+        case ConfigError::syntax: return "invalid JSON";
+        case ConfigError::too_deep: return "nested too deep";
+        case ConfigError::missing_field: return "missing field";
+        case ConfigError::wrong_type: return "wrong type";
+        case ConfigError::out_of_range: return "value out of range";
+    }
+    return "unknown error";
+}
+
+ConfigStatus parse_gadget_config(const char *data, size_t size, GadgetConfig &config) {
+    GadgetConfig parsed{};
+    ConfigParser parser{data, data, data + size, parsed};
+    if (parser.value(ALL_FIELDS, 0)) {
+        parser.skip_space();
+        if (parser.p != parser.end) parser.fail(ConfigError::syntax);
+    } else {
+        parser.fail(ConfigError::syntax);
+    }
+    if (!parser.status) return parser.status;
+
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        if (parser.seen >> i & 1) continue;
+        if (config_schema[i].required) {
+            parser.fail(ConfigError::missing_field, i);
+            return parser.status;
+        }
+        // An optional field that was unset again by a later duplicate
+        memset(reinterpret_cast<char *>(&parsed) + config_schema[i].offset, 0, config_schema[i].size);
+    }
+    parsed.has_generation = parser.seen >> GENERATION_FIELD & 1;
+    config = parsed;
+    return parser.status;
+}
+
+ConfigStatus read_gadget_config(const char *path, GadgetConfig &config) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return {ConfigError::io, 0, nullptr};
+    char buf[CONFIG_MAX_SIZE];
+    size_t size = 0;
+    while (size < sizeof(buf)) {
+        ssize_t n = read(fd, buf + size, sizeof(buf) - size);
+        if (n <= 0) break;
+        size += n;
+    }
+    close(fd);
+    // A larger config is not one the tool wrote
+    if (size == sizeof(buf)) return {ConfigError::too_large, size, nullptr};
+    return parse_gadget_config(buf, size, config);
+}
+
+size_t format_gadget_config(const GadgetConfig &config, char *buf, size_t size) {
+    ConfigWriter writer{buf, size};
+    // Number of objects open below the top level one
+    int open = 0;
+    bool first = true;
+    writer.put("{");
+    for (int i = 0; i < FIELD_COUNT; i++) {
+        const FieldPath &path = field_paths[i];
+        int common = i > 0 ? common_prefix(field_paths[i - 1], path) : 0;
+        for (; open > common; open--) {
+            writer.put("\n");
+            writer.indent(open);
+            writer.put("}");
+            first = false;
+        }
+        for (; open < path.depth - 1; open++) {
+            writer.put(first ? "\n" : ",\n");
+            writer.indent(open + 1);
+            writer.quoted(path.keys[open]);
+            writer.put(": {");
+            first = true;
+        }
+        writer.put(first ? "\n" : ",\n");
+        writer.indent(open + 1);
+        writer.quoted(path.keys[open]);
+        writer.put(": ");
+        writer.field_value(config, i);
+        first = false;
+    }
+    for (; open > 0; open--) {
+        writer.put("\n");
+        writer.indent(open);
+        writer.put("}");
+    }
+    writer.put("\n}\n");
+    if (writer.length >= size) return 0;
+    buf[writer.length] = '\0';
+    return writer.length;
+}
@@ -0,0 +1,61 @@
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "dir_watch.h"
+#include "log.h"
+
+#define DIR_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF | \
+                        IN_MOVE_SELF | IN_ONLYDIR)
+// Events after which the watch is gone or incomplete
+#define DIR_WATCH_RESET_MASK (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_Q_OVERFLOW)
+
+DirWatch::~DirWatch() {
+    if (fd >= 0) close(fd);
+}
+
+void DirWatch::add_watch(const std::string& new_dir) {
+    if (fd < 0) fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) return;
+    // Tried again on every call while it fails, reported once
+    bool failed_before = wd < 0 && new_dir == dir;
+    if (wd >= 0) inotify_rm_watch(fd, wd);
+    dir = new_dir;
+    wd = inotify_add_watch(fd, dir.c_str(), DIR_WATCH_MASK);
+    if (wd < 0 && !failed_before) LOGE("Cannot watch %s: %s", dir.c_str(), strerror(errno));
+}
+
+bool DirWatch::changed(const std::string& new_dir, bool (*filter)(std::string_view name)) {
+    // Watching before the caller reads, nothing changed in between goes unnoticed
+    if (wd < 0 || new_dir != dir) {
+        add_watch(new_dir);
+        return true;
+    }
+
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+    bool reset = false;
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        for (ssize_t off = 0; off < n;) {
+            auto event = reinterpret_cast<const struct inotify_event *>(buf + off);
+            off += sizeof(*event) + event->len;
+            // Left over from a watch that was replaced
+            if (event->wd != wd && !(event->mask & IN_Q_OVERFLOW)) continue;
+            if (event->mask & DIR_WATCH_RESET_MASK) {
+                reset = true;
+            } else if (event->len == 0 || filter(event->name)) {
+                changed = true;
+            }
+        }
+    }
+    if (reset) {
+        LOGD("%s was replaced, watching it again", dir.c_str());
+        add_watch(dir);
+        return true;
+    }
+    return changed;
+}
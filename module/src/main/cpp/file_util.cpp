@@ -0,0 +1,16 @@
+#include <sys/sendfile.h>
+
+#include "file_util.h"
+
+bool same_file(const struct stat& a, const struct stat& b) {
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+bool copy_fd(int dest, int src, size_t size) {
+    off_t offset = 0;
+    while ((size_t) offset < size) {
+        if (sendfile(dest, src, &offset, size - offset) <= 0) return false;
+    }
+    return true;
+}
@@ -0,0 +1,100 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+
+#include "file_util.h"
+#include "gadget_cache.h"
+#include "log.h"
+#include "xdl/xdl_lzma.h"
+
+#define GADGET_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool decompress_into(int fd, int src, size_t src_size) {
+    void *compressed = mmap(nullptr, src_size, PROT_READ, MAP_PRIVATE, src, 0);
+    if (compressed == MAP_FAILED) return false;
+    uint8_t *gadget = nullptr;
+    size_t gadget_size = 0;
+    bool ok = xdl_lzma_decompress((uint8_t *) compressed, src_size, &gadget, &gadget_size) == 0;
+    munmap(compressed, src_size);
+    if (!ok) return false;
+    ok = write_all(fd, gadget, gadget_size);
+    free(gadget);
+    return ok;
+}
+
+// The memfd itself is writable, a reopen through /proc gets a read only open file of its own
+static int reopen_read_only(int memfd) {
+    std::string proc_path = "/proc/self/fd/" + std::to_string(memfd);
+    return open(proc_path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+GadgetCache::~GadgetCache() {
+    if (fd >= 0) close(fd);
+}
+
+int GadgetCache::create(const std::string& path, const struct stat& st) {
+    int src = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src < 0) return -1;
+    int memfd = (int) syscall(__NR_memfd_create, "frida-gadget", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0) {
+        close(src);
+        return -1;
+    }
+    bool compressed = path.ends_with(GADGET_COMPRESSED_SUFFIX);
+    bool ok = compressed ? decompress_into(memfd, src, st.st_size) : copy_fd(memfd, src, st.st_size);
+    close(src);
+    if (!ok) {
+        LOGE("Failed to %s %s", compressed ? "decompress" : "copy", path.c_str());
+        close(memfd);
+        return -1;
+    }
+    return memfd;
+}
+
+int GadgetCache::get(const std::string& path) {
+    std::lock_guard<std::mutex> guard(lock);
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+    if (path == source_path && same_file(st, source)) return fd >= 0 ? reopen_read_only(fd) : -1;
+
+    int memfd = create(path, st);
+    if (memfd < 0) {
+        // A gadget that does not decompress is not tried again until it is replaced
+        if (fd >= 0) close(fd);
+        fd = -1;
+        source_path = path;
+        source = st;
+        return -1;
+    }
+    // Without seals a target could change what the next launches load, so the memfd serves this
+    // launch only and the next one makes its own
+    if (fcntl(memfd, F_ADD_SEALS, GADGET_SEALS) != 0) {
+        LOGE("Cannot seal the gadget memfd, not caching %s", path.c_str());
+        int read_only = reopen_read_only(memfd);
+        close(memfd);
+        return read_only;
+    }
+    if (fd >= 0) close(fd);
+    fd = memfd;
+    source_path = path;
+    source = st;
+    struct stat cached{};
+    fstat(fd, &cached);
+    LOGD("Cached %s, %lld bytes", path.c_str(), (long long) cached.st_size);
+    return reopen_read_only(fd);
+}
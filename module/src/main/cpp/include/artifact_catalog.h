@@ -0,0 +1,69 @@
+#ifndef ZYGISK_GADGET_ARTIFACT_CATALOG_H
+#define ZYGISK_GADGET_ARTIFACT_CATALOG_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dir_watch.h"
+
+#define GADGET_VERSION_PARTS 3
+
+enum class GadgetAbi : uint8_t {
+    arm,
+    arm64,
+    x86,
+    x86_64,
+};
+
+#if defined(__aarch64__)
+#define GADGET_NATIVE_ABI GadgetAbi::arm64
+#elif defined(__arm__)
+#define GADGET_NATIVE_ABI GadgetAbi::arm
+#elif defined(__x86_64__)
+#define GADGET_NATIVE_ABI GadgetAbi::x86_64
+#elif defined(__i386__)
+#define GADGET_NATIVE_ABI GadgetAbi::x86
+#endif
+
+struct GadgetArtifact {
+    std::string name;
+    GadgetAbi abi;
+    uint version[GADGET_VERSION_PARTS];  // 0.0.0 if the name has none
+    bool compressed;                     // xz, named "<...>.so.xz"
+};
+
+// A frida-gadget binary is "<x>-gadget<y><abi>.so", where <abi> is arm, arm64, x86 or x86_64 and
+// the first number in <y> is its version ("frida-gadget-16.1.4-android-arm64.so"), or the same
+// name with ".xz" for one compressed with xz. False if name is not one.
+bool parse_gadget_name(std::string_view name, GadgetArtifact& artifact);
+
+// A frida-gadget config is "<x>-gadget.config"
+bool is_gadget_config_name(std::string_view name);
+
+struct ArtifactSelection {
+    std::string gadget;  // newest gadget for the ABI, uncompressed first, empty if there is none
+    std::string config;  // first config by name, empty if there is none
+};
+
+// The gadgets and configs of the module dir, parsed once from the file names and refreshed from
+// inotify events on the dir. A launch costs a table lookup instead of a directory listing, unless
+// inotify is unavailable: then the dir is listed on every lookup, like before.
+class ArtifactCatalog {
+public:
+    ArtifactSelection lookup(const std::string& module_dir, GadgetAbi abi);
+
+private:
+    void scan_locked();
+
+    std::mutex lock;
+    DirWatch watch;
+    std::string dir;
+    std::vector<GadgetArtifact> gadgets;  // by ABI, newest version first, uncompressed first
+    std::vector<std::string> configs;     // by name
+};
+
+#endif //ZYGISK_GADGET_ARTIFACT_CATALOG_H
@@ -0,0 +1,80 @@
+#ifndef ZYGISK_GADGET_CHUNK_QUEUE_H
+#define ZYGISK_GADGET_CHUNK_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Receives what a ChunkQueue hands over, on the queue's consumer thread.
+class ChunkConsumer {
+public:
+    virtual ~ChunkConsumer() = default;
+    // Whole lines or records, as the producer committed them
+    virtual void consume(const uint8_t *data, size_t size) = 0;
+    // Everything committed before ChunkQueue::flush() has been consumed
+    virtual void flushed() {}
+};
+
+// Output stage of the follower, shared by LogWriter and LogCapture. The decoding thread fills
+// preallocated chunks and commits whole lines or records; a consumer thread takes full chunks
+// from a single-producer, single-consumer ring like LogPipeline's, so committing takes no lock
+// and the producer only waits when every chunk is queued. When no chunk was handed over for
+// idle_ms, the consumer takes what was committed to the current chunk so far, if nothing was
+// added since the previous idle period or at the latest after max_idle_ticks of them under a
+// steady trickle.
+class ChunkQueue {
+public:
+    ChunkQueue(ChunkConsumer &consumer, size_t chunk_size, uint32_t chunk_count, uint idle_ms, uint max_idle_ticks);
+    // Flushes, then stops the consumer thread
+    ~ChunkQueue();
+
+    // Room for size bytes (at most chunk_size), in the current chunk or, once that is handed
+    // over, the next one
+    uint8_t *reserve(size_t size);
+    // Hands the size bytes written at the last reserve() to the consumer
+    void commit(size_t size);
+    // Hands over the current chunk and waits until the consumer took everything and ran flushed()
+    void flush();
+    // Number of times reserve() waited for the consumer
+    uint64_t stalls() const { return stall_count.load(std::memory_order_relaxed); }
+
+private:
+    struct Chunk {
+        uint8_t *data = nullptr;
+        std::atomic<size_t> len{0};  // committed, written by the producer
+        size_t consumed = 0;         // taken by the consumer while the chunk was current
+    };
+
+    void hand_over();
+    void wait_for_consumer(uint32_t flush_seq, uint32_t next_chunk);
+    void wake_consumer();
+    void consume_loop();
+    void take_idle(uint32_t t, size_t &idle_len, uint &ticks);
+
+    ChunkConsumer &consumer;
+    const size_t chunk_size;
+    const uint32_t chunk_count;
+    const uint idle_ms;
+    const uint max_idle_ticks;
+    Chunk *chunks;
+
+    // chunks [tail, head) are queued for the consumer, chunks[head] is being filled
+    alignas(64) std::atomic<uint32_t> head{0};  // written by the producer
+    alignas(64) std::atomic<uint32_t> tail{0};  // written by the consumer
+    std::atomic<uint32_t> flush_requested{0};
+    std::atomic<uint32_t> flush_done{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> stall_count{0};
+    // The producer sleeps on its wake counter. The consumer also needs a timeout, so it sleeps on
+    // a condition variable whose mutex guards nothing but the sleep.
+    std::atomic<bool> producer_waiting{false};
+    std::atomic<uint32_t> producer_wake{0};
+    std::atomic<bool> consumer_waiting{false};
+    std::mutex sleep_lock;
+    std::condition_variable consumer_wakeup;
+    std::thread thread;
+};
+
+#endif //ZYGISK_GADGET_CHUNK_QUEUE_H
@@ -0,0 +1,27 @@
+#ifndef ZYGISK_GADGET_COMPANION_H
+#define ZYGISK_GADGET_COMPANION_H
+
+#include <string>
+
+// Module to companion protocol, one connection per forked app process. A string is its size_t
+// length including the NUL, then its bytes.
+//   module     config path (string), uid (int)
+//   companion  target package (string), empty unless uid is the target app: the exchange ends
+//   module     process name (string)
+//   companion  inject (bool), false ends the exchange. Also false when the process matches but
+//              the gadget (or the frida-gadget config in config mode) cannot be provided.
+//   companion  delay (uint), profile (bool), gadget name (string), name of the frida-gadget config
+//              copied to the app data dir (string, empty if none), has gadget fd (bool) and the
+//              fd itself as SCM_RIGHTS. Without an fd the gadget was copied to the app data dir.
+//
+// The companion side has no JNI or Zygisk dependency, it can be driven over a socketpair.
+void companion_handler(int fd);
+
+void writeString(int fd, const std::string& str);
+// Empty if the other side hung up
+std::string readString(int fd);
+void sendFd(int sock, int fd);
+// -1 if none was received
+int recvFd(int sock);
+
+#endif //ZYGISK_GADGET_COMPANION_H
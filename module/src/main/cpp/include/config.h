@@ -0,0 +1,43 @@
+#ifndef ZYGISK_GADGET_CONFIG_H
+#define ZYGISK_GADGET_CONFIG_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "config_parser.h"
+#include "nlohmann/json.hpp"
+
+// Target of the config while zygisk-gadget is not running
+#define CONFIG_DEFAULT_PACKAGE "com.hackcatml.test"
+
+using json = nlohmann::json;
+
+// Parses a JSON file, null if it is missing or invalid. The module config goes through
+// read_config() instead, this is for files of free form like frida-gadget.config.
+json get_json(const std::string& path);
+
+GadgetConfig default_config();
+
+// The config file, or default_config() if it is missing or corrupt
+GadgetConfig read_config();
+
+// The companion reads the config whenever an app is forked, so it is replaced in one step: a
+// fsync()ed temporary file is renamed over it. Call with a ConfigLock held.
+bool write_config(const GadgetConfig& config);
+
+// Serializes read-modify-write of the config between zygisk-gadget processes. The companion
+// never takes it, it only ever sees whole files.
+class ConfigLock {
+public:
+    ConfigLock();
+    ~ConfigLock();
+
+private:
+    int fd;
+};
+
+// Read-modify-write of the config under a ConfigLock, bumping its "generation"
+bool update_config(const std::function<void(GadgetConfig&)>& update);
+
+#endif //ZYGISK_GADGET_CONFIG_H
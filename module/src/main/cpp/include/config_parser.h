@@ -0,0 +1,71 @@
+#ifndef ZYGISK_GADGET_CONFIG_PARSER_H
+#define ZYGISK_GADGET_CONFIG_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#define CONFIG_PACKAGE_MAX 256  // including the terminating NUL
+#define CONFIG_RULES_MAX 256
+
+// The module config, shared by the companion and the tool. Its JSON layout is the schema table in
+// config_parser.cpp: {"package": {"name", "delay", "process", "mode": {"config", "profile"}}, "generation"}.
+struct GadgetConfig {
+    char package_name[CONFIG_PACKAGE_MAX];
+    uint delay;
+    char process_rules[CONFIG_RULES_MAX];  // see process_matcher.h, empty for the main process only
+    bool config_mode;
+    bool profile;
+    uint64_t generation;  // bumped by the tool on every update, 0 in a hand written config
+    bool has_generation;
+};
+
+enum class ConfigError : uint8_t {
+    none,
+    io,            // cannot read the file
+    too_large,
+    syntax,        // not JSON
+    too_deep,
+    missing_field, // a required field is absent or null
+    wrong_type,    // a required field has another JSON type
+    out_of_range,  // number or string does not fit its field
+};
+
+struct ConfigStatus {
+    ConfigError error;
+    size_t offset;      // in the text, where parsing stopped
+    const char *field;  // dotted path of the field concerned, or nullptr
+
+    explicit operator bool() const { return error == ConfigError::none; }
+};
+
+const char *config_error_string(ConfigError error);
+
+// Parses in one pass straight into config, without allocating. Unknown keys are skipped, optional
+// fields (process, profile, generation) of another type count as absent. config is only written on success.
+ConfigStatus parse_gadget_config(const char *data, size_t size, GadgetConfig &config);
+
+// parse_gadget_config() of a file
+ConfigStatus read_gadget_config(const char *path, GadgetConfig &config);
+
+// Writes config as indented JSON in the schema layout. Returns the length, 0 if buf is too small.
+size_t format_gadget_config(const GadgetConfig &config, char *buf, size_t size);
+
+// Returns false if name does not fit
+static inline bool set_package_name(GadgetConfig &config, std::string_view name) {
+    if (name.size() >= CONFIG_PACKAGE_MAX) return false;
+    memcpy(config.package_name, name.data(), name.size());
+    config.package_name[name.size()] = '\0';
+    return true;
+}
+
+// Returns false if rules do not fit
+static inline bool set_process_rules(GadgetConfig &config, std::string_view rules) {
+    if (rules.size() >= CONFIG_RULES_MAX) return false;
+    memcpy(config.process_rules, rules.data(), rules.size());
+    config.process_rules[rules.size()] = '\0';
+    return true;
+}
+
+#endif //ZYGISK_GADGET_CONFIG_PARSER_H
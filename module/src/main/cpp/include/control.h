@@ -0,0 +1,52 @@
+#ifndef ZYGISK_GADGET_CONTROL_H
+#define ZYGISK_GADGET_CONTROL_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+
+// `zygisk-gadget daemon` holds the config and serves it on an abstract Unix socket, root only.
+// Every message is one text line.
+//
+// Requests, answered with "ok <snapshot>" or "error <reason>":
+//   show
+//   target <package>             also resets the process rules
+//   delay <microseconds>
+//   config on|off
+//   profile on|off
+//   process [<rule>...]          see process_matcher.h, none for the main process only
+//   set <package> <microseconds> <config 0|1> <profile 0|1> [<rule>...]
+// "subscribe" is answered with "snapshot <snapshot>" now and after every change, until the
+// subscriber disconnects. The companion subscribes, so a change applies to the next fork without
+// the config file being read.
+//
+// A snapshot is "<generation> <package> <delay> <config 0|1> <profile 0|1> [<rule>...]", the
+// rules are the rest of the line.
+#define CONTROL_SOCKET_NAME "zygisk_gadget.control"
+#define CONTROL_LINE_MAX 1024
+#define CONTROL_SNAPSHOT_FORMAT "%llu %255s %u %d %d%n"
+
+static inline socklen_t control_address(struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // Abstract namespace: leading NUL, no file to clean up
+    memcpy(addr->sun_path + 1, CONTROL_SOCKET_NAME, sizeof(CONTROL_SOCKET_NAME) - 1);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + sizeof(CONTROL_SOCKET_NAME) - 1;
+}
+
+// Connected socket to the daemon, -1 if it is not running
+static inline int control_connect() {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_un addr;
+    socklen_t len = control_address(&addr);
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), len) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#endif //ZYGISK_GADGET_CONTROL_H
@@ -0,0 +1,16 @@
+#ifndef ZYGISK_GADGET_DAEMON_H
+#define ZYGISK_GADGET_DAEMON_H
+
+#include <string>
+
+// zygisk-gadget daemon: owns the config and serves it on the control socket (see control.h)
+// until killed. Every change is pushed to the subscribed companion first and then persisted.
+int run_daemon();
+
+// zygisk-gadget ctl <request>: sends one request to the daemon and prints the reply
+int run_ctl(int argc, char *argv[]);
+
+// Sends one request line to the daemon, false if none is running. reply is the answer line.
+bool control_request(const std::string& request, std::string& reply);
+
+#endif //ZYGISK_GADGET_DAEMON_H
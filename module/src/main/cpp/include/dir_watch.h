@@ -0,0 +1,25 @@
+#ifndef ZYGISK_GADGET_DIR_WATCH_H
+#define ZYGISK_GADGET_DIR_WATCH_H
+
+#include <string>
+#include <string_view>
+
+// inotify watch on the entries of one directory, polled without blocking. Not thread safe.
+class DirWatch {
+public:
+    ~DirWatch();
+
+    // True if an entry of dir accepted by filter may have changed since the last call: after an
+    // inotify event for it, on the first call for dir, after dir was replaced, and always if
+    // inotify is unavailable.
+    bool changed(const std::string& dir, bool (*filter)(std::string_view name));
+
+private:
+    void add_watch(const std::string& new_dir);
+
+    std::string dir;
+    int fd = -1;
+    int wd = -1;
+};
+
+#endif //ZYGISK_GADGET_DIR_WATCH_H
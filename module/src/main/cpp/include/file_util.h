@@ -0,0 +1,15 @@
+#ifndef ZYGISK_GADGET_FILE_UTIL_H
+#define ZYGISK_GADGET_FILE_UTIL_H
+
+#include <sys/stat.h>
+#include <cstddef>
+
+// Same inode, size and mtime. The tool and adb push replace a file with rename(), which gives it a
+// new inode, an edit in place changes size or mtime.
+bool same_file(const struct stat& a, const struct stat& b);
+
+// Copies the first size bytes of src to dest, reading src from its start whatever the offset it
+// shares with its other fds
+bool copy_fd(int dest, int src, size_t size);
+
+#endif //ZYGISK_GADGET_FILE_UTIL_H
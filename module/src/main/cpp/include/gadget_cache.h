@@ -0,0 +1,32 @@
+#ifndef ZYGISK_GADGET_GADGET_CACHE_H
+#define ZYGISK_GADGET_GADGET_CACHE_H
+
+#include <sys/stat.h>
+#include <mutex>
+#include <string>
+
+#define GADGET_COMPRESSED_SUFFIX ".xz"
+
+// The gadget as a sealed memfd, made once per gadget file instead of once per launch. A compressed
+// gadget (<name>.so.xz, as Frida publishes them) is decompressed by the xz decoder of the system
+// liblzma, which checks the integrity check of the stream. The sealed memfd cannot be changed by a
+// process it was handed to, so every later launch gets the verified bytes.
+class GadgetCache {
+public:
+    ~GadgetCache();
+
+    // A new read only fd of the gadget at path for the caller to close, with an offset of its own,
+    // -1 on failure. Made again when the file at path is another one than last time, a failure is
+    // also kept until then.
+    int get(const std::string& path);
+
+private:
+    int create(const std::string& path, const struct stat& st);
+
+    std::mutex lock;
+    std::string source_path;
+    struct stat source{};
+    int fd = -1;  // -1 if source failed
+};
+
+#endif //ZYGISK_GADGET_GADGET_CACHE_H
@@ -0,0 +1,41 @@
+#ifndef ZYGISK_GADGET_LAUNCH_STATS_H
+#define ZYGISK_GADGET_LAUNCH_STATS_H
+
+#include <sys/types.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Correlates the start of each process the gadget is injected into (am_proc_start) with the
+// module's "Frida-gadget loaded" / "Frida-gadget failed to load" line of the same pid. A launch
+// still without either line when the app starts again, or when its pid starts again, counts as
+// failed. Plain C++, no logd involved, so it can be driven from recorded logs on any host.
+class LaunchStats {
+public:
+    // The main process started: launches still pending belong to the previous run
+    void on_app_start();
+    void on_process_start(pid_t pid, uint32_t sec, uint32_t nsec);
+    // loaded is false for "Frida-gadget failed to load"
+    void on_gadget_result(pid_t pid, uint32_t sec, uint32_t nsec, bool loaded);
+
+    // Launches with a result, loaded or failed
+    size_t completed() const { return latencies_us.size() + failed; }
+    size_t failures() const { return failed; }
+    // Latency of the last loaded launch
+    uint64_t last_latency_us() const { return latencies_us.empty() ? 0 : latencies_us.back(); }
+
+    // Multi-line summary: counts, min/p50/p95/p99/max and a power-of-two histogram in ms
+    std::string report() const;
+
+private:
+    struct Pending {
+        pid_t pid;
+        uint64_t start_us;
+    };
+
+    std::vector<Pending> pending;
+    size_t failed = 0;
+    std::vector<uint64_t> latencies_us;
+};
+
+#endif //ZYGISK_GADGET_LAUNCH_STATS_H
@@ -0,0 +1,78 @@
+#ifndef ZYGISK_GADGET_LOG_CAPTURE_H
+#define ZYGISK_GADGET_LOG_CAPTURE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chunk_queue.h"
+#include "log_source.h"
+
+#define LOG_CAPTURE_BLOCK_SIZE (64 * 1024)  // uncompressed, the LZ4 frame block maximum
+#define LOG_CAPTURE_BLOCKS 8
+#define LOG_CAPTURE_SEGMENT_SIZE (16 * 1024 * 1024)  // compressed bytes per segment
+#define LOG_CAPTURE_MAX_SEGMENTS 32                  // older segments are deleted
+#define LOG_CAPTURE_WRITE_BATCH (256 * 1024)
+#define LOG_CAPTURE_IDLE_MS 1000
+#define LOG_CAPTURE_MAX_IDLE_TICKS 10
+
+// Segment <n>.zglog.lz4 is an LZ4 frame (independent 64 KiB blocks, block checksums) that
+// decompresses to a capture file as written by RecordingSource, so `lz4 -d` and --replay read it.
+// The first block only holds LOG_CAPTURE_MAGIC, every other block starts at a record boundary.
+// <n>.idx is LOG_CAPTURE_INDEX_MAGIC followed by one LogCaptureIndexEntry per block: a time range
+// is extracted by decompressing from the block of the last entry before its start, prefixed with
+// the magic.
+#define LOG_CAPTURE_INDEX_MAGIC "ZGIDXv1\n"
+#define LOG_CAPTURE_INDEX_MAGIC_LEN 8
+
+struct LogCaptureIndexEntry {
+    uint32_t sec;     // timestamp of the first record in the block
+    uint32_t nsec;
+    uint64_t offset;  // of the block header in the segment
+};
+
+// Long running on-device capture. add() copies records into the raw blocks of a ChunkQueue, its
+// consumer thread turns each block into an LZ4 block and appends them to the current segment in
+// batches (O_APPEND). Segments are only fdatasync()ed when they are closed, at
+// LOG_CAPTURE_SEGMENT_SIZE.
+class LogCapture : private ChunkConsumer {
+public:
+    // Continues the numbering of the segments already in dir, which is created if needed
+    static std::unique_ptr<LogCapture> open(const char *dir);
+    ~LogCapture();
+
+    void add(const log_msg *msg);
+    // Compress and write everything added so far and close the current segment
+    void close();
+    // Number of times add() waited for the compressor thread
+    uint64_t stalls() const { return queue.stalls(); }
+
+private:
+    LogCapture(std::string dir, std::vector<uint> segments);
+    // On the queue's thread: whole records, at most one block
+    void consume(const uint8_t *data, size_t size) override;
+    void flushed() override;
+    bool open_segment();
+    void close_segment();
+    void write_batch();
+    void fail(const char *what);
+
+    std::string dir;
+    std::vector<uint> segments;  // numbers of the segments on disk, oldest first
+
+    // Owned by the queue's thread
+    int segment_fd = -1;
+    int index_fd = -1;
+    uint64_t segment_size = 0;  // bytes of the segment, including the unwritten batch
+    std::unique_ptr<uint8_t[]> compressed;
+    std::unique_ptr<uint8_t[]> batch;
+    size_t batch_len = 0;
+    LogCaptureIndexEntry index_batch[64]{};
+    size_t index_len = 0;
+    bool failed = false;  // a write failed, reported once
+
+    ChunkQueue queue;  // last, so it is stopped before the rest goes away
+};
+
+#endif //ZYGISK_GADGET_LOG_CAPTURE_H
@@ -0,0 +1,59 @@
+#ifndef ZYGISK_GADGET_LOG_PIPELINE_H
+#define ZYGISK_GADGET_LOG_PIPELINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "log_source.h"
+
+#define LOG_PIPELINE_SLOTS 1024  // must be a power of two
+
+// Reader stage of the follower: a thread reads the source into a bounded single-producer,
+// single-consumer ring of preallocated log_msg slots, which the decoding thread consumes in place.
+// A lossy pipeline (live logd) never lets the reader wait for the decoder: when the ring is full
+// the entry is read into a scratch slot and counted as dropped, so logd keeps being drained.
+// A lossless one (replay) makes the reader wait instead.
+class LogPipeline {
+public:
+    LogPipeline(LogSource &source, bool lossy);
+    // Joins the reader, which must not be blocked in the source any more (see stop())
+    ~LogPipeline();
+
+    // Next entry for the decoder, nullptr once the source is exhausted. The entry stays valid
+    // until the next call.
+    log_msg *next();
+    // Makes the reader stop after its current read
+    void stop();
+    // For a signal handler on the decoding thread: next() returns nullptr from now on. Only
+    // touches lock-free atomics.
+    void interrupt();
+
+    uint64_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+    // Result of the last read: > 0 while running, 0 at the end of the source, < 0 if it broke
+    int source_status() const { return status.load(std::memory_order_acquire); }
+
+private:
+    void reader_loop();
+
+    LogSource &source;
+    bool lossy;
+    log_msg *slots;
+    log_msg scratch{};
+    bool holding = false;  // the decoder has not released the slot at tail yet
+
+    alignas(64) std::atomic<uint32_t> head{0};  // written by the reader
+    alignas(64) std::atomic<uint32_t> tail{0};  // written by the decoder
+    // A waiting side sleeps on its wake counter, the other side bumps it when it sees the flag
+    std::atomic<bool> decoder_waiting{false};
+    std::atomic<bool> reader_waiting{false};
+    std::atomic<uint32_t> decoder_wake{0};
+    std::atomic<uint32_t> reader_wake{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> interrupted{false};
+    std::atomic<int> status{1};
+    std::atomic<uint64_t> dropped_count{0};
+    std::thread reader;
+};
+
+#endif //ZYGISK_GADGET_LOG_PIPELINE_H
@@ -0,0 +1,100 @@
+#ifndef ZYGISK_GADGET_LOG_SOURCE_H
+#define ZYGISK_GADGET_LOG_SOURCE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+struct logger_entry {
+    uint16_t len;      /* length of the payload */
+    uint16_t hdr_size; /* sizeof(struct logger_entry) */
+    int32_t pid;       /* generating process's pid */
+    uint32_t tid;      /* generating process's tid */
+    uint32_t sec;      /* seconds since Epoch */
+    uint32_t nsec;     /* nanoseconds */
+    uint32_t lid;      /* log id of the payload, bottom 4 bits currently */
+    uint32_t uid;      /* generating process's uid */
+};
+
+#define LOGGER_ENTRY_MAX_LEN (5 * 1024)
+struct log_msg {
+    union [[gnu::aligned(4)]] {
+        unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1];
+        struct logger_entry entry;
+    };
+};
+
+// Capture file: LOG_CAPTURE_MAGIC, then every record as logd delivered it (hdr_size + len bytes)
+#define LOG_CAPTURE_MAGIC "ZGLOGv1\n"
+#define LOG_CAPTURE_MAGIC_LEN 8
+
+// Where the follower reads raw log_msg records from.
+class LogSource {
+public:
+    virtual ~LogSource() = default;
+    // Returns the record size (hdr_size + len), 0 at the end of the source, -1 on a broken source.
+    virtual int read(log_msg *msg) = 0;
+};
+
+#define LOGD_SOURCE_BACKOFF_MIN_US 1000
+#define LOGD_SOURCE_BACKOFF_MAX_US (1000 * 1000)
+#define LOGD_SOURCE_MAX_SEEN 32
+
+// Live main and events buffers. When the logd connection breaks it is reopened with exponential
+// backoff, resuming at the timestamp of the last record returned. logd resends the records of that
+// timestamp, those already returned are recognized by (sec, nsec, pid, tid) and skipped.
+class LogdSource : public LogSource {
+public:
+    ~LogdSource() override;
+    int read(log_msg *msg) override;
+
+private:
+    struct Key {
+        int32_t pid;
+        uint32_t tid;
+    };
+
+    bool connect();
+    bool seen(const logger_entry &entry) const;
+    void remember(const logger_entry &entry);
+
+    struct logger_list *list = nullptr;
+    bool resuming = false;
+    uint backoff_us = 0;
+    // Timestamp of the last record returned, and the records returned with exactly that timestamp
+    uint32_t last_sec = 0;
+    uint32_t last_nsec = 0;
+    Key last_keys[LOGD_SOURCE_MAX_SEEN]{};
+    uint last_count = 0;
+};
+
+// A capture file written by RecordingSource.
+class FileSource : public LogSource {
+public:
+    static std::unique_ptr<FileSource> open(const char *path);
+    ~FileSource() override;
+    int read(log_msg *msg) override;
+
+    uint64_t bytes_read() const { return bytes; }
+
+private:
+    explicit FileSource(FILE *file) : file(file) {}
+    FILE *file;
+    uint64_t bytes = LOG_CAPTURE_MAGIC_LEN;
+};
+
+// Passes the records of another source through and appends them to a capture file.
+class RecordingSource : public LogSource {
+public:
+    static std::unique_ptr<RecordingSource> open(const char *path, std::unique_ptr<LogSource> source);
+    ~RecordingSource() override;
+    int read(log_msg *msg) override;
+    void flush();
+
+private:
+    RecordingSource(FILE *file, std::unique_ptr<LogSource> source) : file(file), source(std::move(source)) {}
+    FILE *file;
+    std::unique_ptr<LogSource> source;
+};
+
+#endif //ZYGISK_GADGET_LOG_SOURCE_H
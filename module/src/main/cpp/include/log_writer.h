@@ -0,0 +1,96 @@
+#ifndef ZYGISK_GADGET_LOG_WRITER_H
+#define ZYGISK_GADGET_LOG_WRITER_H
+
+#include <ctime>
+#include <string_view>
+
+#include "chunk_queue.h"
+
+#define LOG_WRITER_CHUNK_SIZE (64 * 1024)
+#define LOG_WRITER_CHUNKS 8
+#define LOG_WRITER_IDLE_MS 50
+#define LOG_WRITER_MAX_IDLE_TICKS 4
+
+// --format bin: the file starts with LOG_BIN_MAGIC, followed by records of a LogBinRecord header,
+// the tag and the message, each record padded to a multiple of 8 bytes. All fields little endian.
+#define LOG_BIN_MAGIC "ZGBINv1\n"
+#define LOG_BIN_MAGIC_LEN 8
+
+struct LogBinRecord {
+    uint32_t size;     // whole record including header and padding
+    uint32_t sec;
+    uint32_t nsec;
+    int32_t pid;       // 0 for lines of the tool itself
+    int32_t tid;
+    uint8_t prio;      // android_LogPriority
+    uint8_t reserved;
+    uint16_t tag_len;  // tag bytes right after the header
+    uint32_t msg_len;  // message bytes right after the tag
+};
+
+enum class LogFormat {
+    text,   // "HH:MM:SS.mmm <tag> <message>"
+    jsonl,  // {"ts":<sec>.<nsec>,"pid":..,"tid":..,"prio":..,"tag":"..","msg":".."} per line
+    bin,    // LogBinRecord records
+};
+
+struct LogLine {
+    uint32_t sec;
+    uint32_t nsec;
+    int32_t pid;
+    int32_t tid;
+    uint8_t prio;
+    std::string_view tag;
+    std::string_view message;
+};
+
+// Output stage of the log follower. Lines are formatted by hand, in the selected LogFormat,
+// straight into the chunks of a ChunkQueue, whose thread does the write(2) calls, so a slow
+// terminal or adb pipe only stalls the caller once all chunks are queued. Lines reach the fd when
+// a chunk fills up, after LOG_WRITER_IDLE_MS without one (at the latest after
+// LOG_WRITER_MAX_IDLE_TICKS of them under a steady trickle), and on flush(). Nothing is allocated
+// per line. Lines are written by one thread, the decoding one.
+class LogWriter : private ChunkConsumer {
+public:
+    explicit LogWriter(int fd);
+    ~LogWriter();
+
+    // Must be called before the first line
+    void set_format(LogFormat format);
+    void write(const LogLine &line);
+    // A line of the tool itself (pid 0, info priority)
+    void write_line(uint32_t sec, uint32_t nsec, std::string_view tag, std::string_view message);
+    // Wait until everything is written
+    void flush();
+    // Number of times write_line() waited for the output thread
+    uint64_t stalls() const { return queue.stalls(); }
+
+private:
+    void consume(const uint8_t *data, size_t size) override;
+
+    void append(std::string_view str);
+    void append_timestamp(time_t sec, long nsec);
+    void append_text(const LogLine &line);
+    void append_json(const LogLine &line);
+    void append_json_string(std::string_view str);
+    void append_bin(const LogLine &line);
+    void refresh_tz_offset(time_t sec);
+
+    int fd;
+    LogFormat format = LogFormat::text;
+    char *out = nullptr;  // end of the line being formatted
+
+    // "HH:MM:SS" of cached_sec, and the UTC offset valid in [tz_from, tz_until)
+    time_t cached_sec = -1;
+    char cached_hms[8]{};
+    long tz_offset = 0;
+    time_t tz_from = 0;
+    time_t tz_until = 0;
+
+    ChunkQueue queue;  // last, so it is stopped before the rest goes away
+};
+
+// The writer used for stdout by logcat(). It is never destroyed, flush() it before exit().
+LogWriter &stdout_writer();
+
+#endif //ZYGISK_GADGET_LOG_WRITER_H
@@ -3,6 +3,29 @@
 
 const std::string config_file_path = "/data/adb/modules/zygisk_gadget/config";
 
-void logcat();
+struct LogcatOptions {
+    std::string package;      // -p, every log of its processes is followed
+    std::string process_rules;  // -n, the processes the gadget is injected into, like the companion
+    uint measure = 0;         // --measure, launches to collect before returning
+    std::string record_path;  // --record, capture file for the raw logd records
+    std::string replay_path;  // --replay, capture file read instead of logd
+    std::string capture_dir;  // --capture, directory for the rotating compressed segments
+    std::vector<std::string> tags;   // --tag, also follow lines whose tag contains one of these
+    std::vector<std::string> greps;  // --grep, also follow lines whose message contains one of these
+    LogFormat format = LogFormat::text;  // --format
+};
+
+// Follow the ZygiskGadget logs, the --tag/--grep matches and every log of the processes of the package or the process
+// rules. --measure times every process the rules inject into. Only returns when --measure collected its launches
+// (printing the start -> gadget loaded latencies), a replay ends or logcat_interrupt() was called.
+void logcat(const LogcatOptions &options);
+
+// For the SIGINT handler: logcat() stops following and returns, after writing out the output and
+// the capture as usual. Only sets flags, so it is safe in a handler.
+void logcat_interrupt();
+bool logcat_interrupted();
+
+// The processes that logged the start of their profiler, for --profile to stop them
+std::vector<pid_t> logcat_profiled_pids();
 
 #endif //ZYGISK_GADGET_LOGCAT_H
@@ -0,0 +1,32 @@
+#ifndef ZYGISK_GADGET_MATCHER_H
+#define ZYGISK_GADGET_MATCHER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Substring matcher for any number of patterns: the patterns are compiled into one Aho-Corasick
+// automaton with every failure transition resolved, so a scan is a single table lookup per byte
+// no matter how many patterns there are. The table is indexed by byte class (bytes that occur in
+// no pattern share one), which keeps it small enough for L1.
+class MultiMatcher {
+public:
+    // Patterns can be added until the first call to build()
+    void add(std::string_view pattern);
+    void build();
+
+    bool empty() const { return patterns.empty(); }
+    // True if any pattern occurs in text
+    bool contains_any(std::string_view text) const;
+
+private:
+    std::vector<std::string> patterns;
+    uint8_t byte_class[256]{};
+    uint32_t classes = 1;
+    int single_first_byte = -1;   // the first byte of every pattern, or < 0
+    std::vector<uint32_t> next;   // state * classes + byte_class[byte] -> state
+    std::vector<uint8_t> output;  // state -> a pattern ends here
+};
+
+#endif //ZYGISK_GADGET_MATCHER_H
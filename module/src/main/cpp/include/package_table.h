@@ -0,0 +1,69 @@
+#ifndef ZYGISK_GADGET_PACKAGE_TABLE_H
+#define ZYGISK_GADGET_PACKAGE_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "dir_watch.h"
+
+// Host builds point it at a directory of their own
+#ifndef PACKAGES_LIST_DIR
+#define PACKAGES_LIST_DIR "/data/system"
+#endif
+#define PACKAGES_LIST_NAME "packages.list"
+#define AID_USER_OFFSET 100000  // uid = user id * AID_USER_OFFSET + app id
+// App zygotes and isolated processes, e.g. com.foo:sandboxed_process0, run under app ids of their own
+#define AID_ISOLATED_START 90000
+#define AID_ISOLATED_END 99999
+
+// Package name to app id, sorted by name. Names are kept in one string.
+class PackageTable {
+public:
+    // Replaces the table with the packages of a packages.list, one package per line:
+    // "<name> <uid> <debuggable> <data dir> <seinfo> <gids> ...". Malformed lines are skipped.
+    void parse(const char *data, size_t size);
+
+    // -1 if package is not in the table
+    int app_id(std::string_view package) const;
+
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry {
+        uint32_t name_offset;
+        uint32_t name_length;
+        uint32_t app_id;
+    };
+
+    std::string_view name(const Entry& entry) const {
+        return std::string_view(names).substr(entry.name_offset, entry.name_length);
+    }
+
+    std::string names;
+    std::vector<Entry> entries;
+};
+
+// PackageTable of <dir>/PACKAGES_LIST_NAME, reloaded once inotify reports that PackageManager
+// replaced it
+class InstalledPackages {
+public:
+    explicit InstalledPackages(std::string dir = PACKAGES_LIST_DIR) : dir(std::move(dir)) {}
+
+    // -1 if package is not installed or the list cannot be read
+    int app_id(std::string_view package);
+
+private:
+    bool load_locked();
+
+    const std::string dir;
+    std::mutex lock;
+    DirWatch watch;
+    PackageTable table;
+};
+
+#endif //ZYGISK_GADGET_PACKAGE_TABLE_H
@@ -0,0 +1,24 @@
+#ifndef ZYGISK_GADGET_PLT_HOOK_H
+#define ZYGISK_GADGET_PLT_HOOK_H
+
+#define PLT_HOOK_MAX_SLOTS 64   // slots importing one symbol in one module
+
+// GOT/PLT hooking on top of xdl: imports of a symbol are redirected by rewriting the GOT slots the
+// dynamic linker filled in, so a hooked call costs the same single indirect branch as before.
+//
+// Relocations are read from DT_JMPREL, DT_RELA/DT_REL and Android packed relocations (APS2).
+// DT_RELR only carries relative relocations and never references a symbol, so it is skipped.
+// The module that contains new_func is never patched, so the hook can call the symbol directly.
+//
+// Both functions return the number of patched slots, or -1 on invalid arguments or when a module
+// imports symbol through more than PLT_HOOK_MAX_SLOTS slots. Such a module is left unpatched,
+// plt_hook() still patches the others. old_func (optional) receives the previous value of the
+// first patched slot. To unhook, hook again with *old_func.
+
+// Patch the imports of symbol in every loaded module.
+int plt_hook(const char *symbol, void *new_func, void **old_func);
+
+// Patch the imports of symbol in the module opened with xdl_open().
+int plt_hook_module(void *handle, const char *symbol, void *new_func, void **old_func);
+
+#endif //ZYGISK_GADGET_PLT_HOOK_H
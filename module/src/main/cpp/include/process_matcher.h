@@ -0,0 +1,39 @@
+#ifndef ZYGISK_GADGET_PROCESS_MATCHER_H
+#define ZYGISK_GADGET_PROCESS_MATCHER_H
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#define PROCESS_MATCHER_MAX_STATES 1024
+
+// Process rules of the target package, separated by spaces:
+//   com.foo          the main process
+//   :push            com.foo:push, relative to the target package
+//   com.foo:push     the same, spelled out
+//   :*, com.foo:w?   globs after the colon: * is any run of characters, ? any one character
+// Every rule is anchored at the package or "<package>:", so rules only ever select processes of
+// the target, whose uid the companion checks first.
+// All rules are compiled into one DFA (subset construction over the rules' positions, with the
+// bytes no rule names folded into one class), so matching a process name is one table walk
+// whatever the number of rules.
+class ProcessMatcher {
+public:
+    // The first rule of rules that is none of the above, empty if there is none
+    static std::string_view invalid_rule(std::string_view rules, std::string_view package);
+
+    // False if a rule is invalid or the rules need more than PROCESS_MATCHER_MAX_STATES states,
+    // nothing matches then
+    bool compile(std::string_view rules, std::string_view package);
+
+    bool matches(std::string_view process) const;
+
+private:
+    uint8_t classes[256]{};         // byte to character class, 0 for bytes no rule names
+    uint class_count = 1;
+    std::vector<uint16_t> next{0};  // [state * class_count + class], state 0 is dead
+    std::vector<bool> accepting{false};
+    uint16_t start = 0;
+};
+
+#endif //ZYGISK_GADGET_PROCESS_MATCHER_H
@@ -0,0 +1,20 @@
+#ifndef ZYGISK_GADGET_PROFILER_H
+#define ZYGISK_GADGET_PROFILER_H
+
+#include <sys/types.h>
+
+#define PROFILER_DEFAULT_HZ 100
+#define PROFILER_OUTPUT_NAME "zygisk-gadget.folded"
+
+// Sample every thread of the process on its own CPU clock (SIGPROF) and periodically write the
+// symbolized stacks to output_path in folded format ("root;caller;callee count").
+bool profiler_start(const char *output_path, uint hz);
+
+// Stop sampling and write the final folded output.
+void profiler_stop();
+
+// SIGPROF sent to a profiled process with sigqueue() and this value stops its profiler, as the
+// tool does before it pulls the output
+#define PROFILER_STOP_REQUEST 0x70726f66
+
+#endif //ZYGISK_GADGET_PROFILER_H
@@ -0,0 +1,37 @@
+#ifndef ZYGISK_GADGET_UNWINDER_H
+#define ZYGISK_GADGET_UNWINDER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Allocation-free stack unwinder driven by .eh_frame_hdr (PT_GNU_EH_FRAME).
+// Supported on aarch64 and x86_64; other ABIs return 0 frames.
+// The returned pcs are raw return addresses, symbolize them with xdl_addr().
+
+#define UNWIND_MAX_FRAMES 32
+
+// The memory of a thread's stack, [lo, hi). Frame pointers and CFAs outside it end the walk, so a
+// register holding garbage or used as a general purpose one is never dereferenced.
+struct UnwindStack {
+    uintptr_t lo;
+    uintptr_t hi;
+};
+
+// Stack of the calling thread, from pthread_getattr_np(). Not async-signal-safe.
+bool unwind_current_stack(UnwindStack *stack);
+
+// The stack pointer of a signal context (ucontext_t *), 0 on unsupported ABIs.
+uintptr_t unwind_stack_pointer(const void *ucontext);
+
+// Unwind the calling thread, starting from the caller of unwind_backtrace().
+size_t unwind_backtrace(uintptr_t *pcs, size_t max_frames);
+
+// Unwind from a signal context (ucontext_t *) on stack. Async-signal-safe: it only uses the module
+// table built by unwind_refresh_modules() and never calls into the linker. With an empty stack only
+// the interrupted pc is returned.
+size_t unwind_from_ucontext(const void *ucontext, const UnwindStack &stack, uintptr_t *pcs, size_t max_frames);
+
+// Rebuild the module table from xdl_iterate_phdr(). Call it after libraries were loaded or unloaded.
+void unwind_refresh_modules();
+
+#endif //ZYGISK_GADGET_UNWINDER_H
@@ -0,0 +1,70 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "package_table.h"
+#include "log.h"
+
+void PackageTable::parse(const char *data, size_t size) {
+    names.clear();
+    entries.clear();
+    std::string_view text(data, size);
+    while (!text.empty()) {
+        size_t eol = text.find('\n');
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(eol == std::string_view::npos ? text.size() : eol + 1);
+
+        size_t name_end = line.find(' ');
+        if (name_end == 0 || name_end == std::string_view::npos) continue;
+        std::string_view uid_field = line.substr(name_end + 1);
+        uint64_t uid = 0;
+        size_t digits = 0;
+        while (digits < uid_field.size() && uid_field[digits] >= '0' && uid_field[digits] <= '9' && uid <= UINT32_MAX) {
+            uid = uid * 10 + (uid_field[digits++] - '0');
+        }
+        if (digits == 0 || uid > UINT32_MAX || (digits < uid_field.size() && uid_field[digits] != ' ')) continue;
+
+        entries.push_back({(uint32_t) names.size(), (uint32_t) name_end, (uint32_t) (uid % AID_USER_OFFSET)});
+        names.append(line.data(), name_end);
+    }
+    std::sort(entries.begin(), entries.end(), [this](const Entry& a, const Entry& b) { return name(a) < name(b); });
+}
+
+int PackageTable::app_id(std::string_view package) const {
+    auto it = std::lower_bound(entries.begin(), entries.end(), package,
+                               [this](const Entry& entry, std::string_view key) { return name(entry) < key; });
+    if (it == entries.end() || name(*it) != package) return -1;
+    return (int) it->app_id;
+}
+
+static bool is_packages_list(std::string_view name) {
+    return name == PACKAGES_LIST_NAME;
+}
+
+bool InstalledPackages::load_locked() {
+    int fd = open((dir + "/" PACKAGES_LIST_NAME).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st{};
+    std::string data;
+    if (fstat(fd, &st) == 0) data.resize(st.st_size);
+    size_t size = 0;
+    while (true) {
+        if (size == data.size()) data.resize(std::max<size_t>(data.size() * 2, 4096));
+        ssize_t n = read(fd, data.data() + size, data.size() - size);
+        if (n <= 0) break;
+        size += n;
+    }
+    close(fd);
+    table.parse(data.data(), size);
+    LOGD("%zu packages in " PACKAGES_LIST_NAME, table.size());
+    return true;
+}
+
+int InstalledPackages::app_id(std::string_view package) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (watch.changed(dir, is_packages_list) && !load_locked()) {
+        table.parse(nullptr, 0);
+    }
+    return table.app_id(package);
+}
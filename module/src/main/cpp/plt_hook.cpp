@@ -0,0 +1,355 @@
+#include <elf.h>
+#include <link.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+#include "plt_hook.h"
+#include "xdl.h"
+
+
+#ifndef DT_ANDROID_REL
+#define DT_ANDROID_REL 0x6000000f
+#define DT_ANDROID_RELSZ 0x60000010
+#define DT_ANDROID_RELA 0x60000011
+#define DT_ANDROID_RELASZ 0x60000012
+#endif
+#ifndef DT_RELR
+#define DT_RELR 36
+#endif
+
+// flags of an APS2 relocation group
+#define RELOCATION_GROUPED_BY_INFO_FLAG 1
+#define RELOCATION_GROUPED_BY_OFFSET_DELTA_FLAG 2
+#define RELOCATION_GROUPED_BY_ADDEND_FLAG 4
+#define RELOCATION_GROUP_HAS_ADDEND_FLAG 8
+
+#if defined(__LP64__)
+#define ELF_R_SYM(info) ELF64_R_SYM(info)
+#define ELF_R_TYPE(info) ELF64_R_TYPE(info)
+#else
+#define ELF_R_SYM(info) ELF32_R_SYM(info)
+#define ELF_R_TYPE(info) ELF32_R_TYPE(info)
+#endif
+
+#if defined(__aarch64__)
+#define R_JUMP_SLOT R_AARCH64_JUMP_SLOT
+#define R_GLOB_DAT R_AARCH64_GLOB_DAT
+#define R_ABS R_AARCH64_ABS64
+#elif defined(__arm__)
+#define R_JUMP_SLOT R_ARM_JUMP_SLOT
+#define R_GLOB_DAT R_ARM_GLOB_DAT
+#define R_ABS R_ARM_ABS32
+#elif defined(__x86_64__)
+#define R_JUMP_SLOT R_X86_64_JUMP_SLOT
+#define R_GLOB_DAT R_X86_64_GLOB_DAT
+#define R_ABS R_X86_64_64
+#elif defined(__i386__)
+#define R_JUMP_SLOT R_386_JMP_SLOT
+#define R_GLOB_DAT R_386_GLOB_DAT
+#define R_ABS R_386_32
+#endif
+
+struct HookModule {
+    uintptr_t load_bias;
+    const ElfW(Phdr) *phdr;
+    size_t phnum;
+
+    const ElfW(Sym) *dynsym;
+    const char *dynstr;
+    uintptr_t jmprel;
+    size_t jmprel_size;
+    bool jmprel_is_rela;
+    uintptr_t rela;
+    size_t rela_size;
+    uintptr_t rel;
+    size_t rel_size;
+    uintptr_t android_rel;
+    size_t android_rel_size;
+    bool android_rel_is_rela;
+};
+
+struct HookRequest {
+    const char *symbol;
+    void *new_func;
+    void *old_func;
+    bool has_old_func;
+    int patched;
+    bool overflow;
+};
+
+struct SlotList {
+    uintptr_t slots[PLT_HOOK_MAX_SLOTS];
+    size_t count;
+    bool overflow;  // more slots than PLT_HOOK_MAX_SLOTS, none are patched
+};
+
+// Hooks sharing a RELRO page must not interleave: one would make it read-only again while the
+// other is still writing.
+static pthread_mutex_t patch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// bionic keeps d_ptr relative to the load bias; glibc has already relocated most of them
+static uintptr_t dyn_ptr(const HookModule &module, ElfW(Addr) ptr) {
+    return ptr < module.load_bias ? module.load_bias + ptr : ptr;
+}
+
+static bool parse_dynamic(HookModule &module) {
+    const ElfW(Dyn) *dynamic = nullptr;
+    for (size_t i = 0; i < module.phnum; i++) {
+        if (module.phdr[i].p_type == PT_DYNAMIC) {
+            dynamic = reinterpret_cast<const ElfW(Dyn) *>(module.load_bias + module.phdr[i].p_vaddr);
+            break;
+        }
+    }
+    if (dynamic == nullptr) return false;
+
+    for (const ElfW(Dyn) *entry = dynamic; entry->d_tag != DT_NULL; entry++) {
+        switch (entry->d_tag) {
+            case DT_SYMTAB:
+                module.dynsym = reinterpret_cast<const ElfW(Sym) *>(dyn_ptr(module, entry->d_un.d_ptr));
+                break;
+            case DT_STRTAB:
+                module.dynstr = reinterpret_cast<const char *>(dyn_ptr(module, entry->d_un.d_ptr));
+                break;
+            case DT_JMPREL:
+                module.jmprel = dyn_ptr(module, entry->d_un.d_ptr);
+                break;
+            case DT_PLTRELSZ:
+                module.jmprel_size = entry->d_un.d_val;
+                break;
+            case DT_PLTREL:
+                module.jmprel_is_rela = entry->d_un.d_val == DT_RELA;
+                break;
+            case DT_RELA:
+                module.rela = dyn_ptr(module, entry->d_un.d_ptr);
+                break;
+            case DT_RELASZ:
+                module.rela_size = entry->d_un.d_val;
+                break;
+            case DT_REL:
+                module.rel = dyn_ptr(module, entry->d_un.d_ptr);
+                break;
+            case DT_RELSZ:
+                module.rel_size = entry->d_un.d_val;
+                break;
+            case DT_ANDROID_REL:
+            case DT_ANDROID_RELA:
+                module.android_rel = dyn_ptr(module, entry->d_un.d_ptr);
+                module.android_rel_is_rela = entry->d_tag == DT_ANDROID_RELA;
+                break;
+            case DT_ANDROID_RELSZ:
+            case DT_ANDROID_RELASZ:
+                module.android_rel_size = entry->d_un.d_val;
+                break;
+            case DT_RELR:  // relative relocations only, nothing imports a symbol there
+            default:
+                break;
+        }
+    }
+    return module.dynsym != nullptr && module.dynstr != nullptr;
+}
+
+// An absolute relocation with an addend points into the symbol rather than at it, so its slot is left
+// alone. REL tables keep that addend in the slot the linker overwrote, their absolute relocations
+// are skipped whatever it was.
+static void check_reloc(const HookModule &module, const char *symbol, ElfW(Addr) offset, uintptr_t info,
+                        bool has_addend, intptr_t addend, SlotList &slots) {
+    uintptr_t type = ELF_R_TYPE(info);
+    if (type != R_JUMP_SLOT && type != R_GLOB_DAT && type != R_ABS) return;
+    if (type == R_ABS && (!has_addend || addend != 0)) return;
+
+    uintptr_t sym = ELF_R_SYM(info);
+    if (sym == 0) return;
+    if (strcmp(module.dynstr + module.dynsym[sym].st_name, symbol) != 0) return;
+
+    uintptr_t slot = module.load_bias + offset;
+    for (size_t i = 0; i < slots.count; i++) {
+        if (slots.slots[i] == slot) return;
+    }
+    if (slots.count == PLT_HOOK_MAX_SLOTS) {
+        slots.overflow = true;
+        return;
+    }
+    slots.slots[slots.count++] = slot;
+}
+
+static void scan_relocs(const HookModule &module, const char *symbol, uintptr_t table, size_t size,
+                        bool is_rela, SlotList &slots) {
+    if (table == 0) return;
+    if (is_rela) {
+        auto relocs = reinterpret_cast<const ElfW(Rela) *>(table);
+        for (size_t i = 0; i < size / sizeof(ElfW(Rela)); i++) {
+            check_reloc(module, symbol, relocs[i].r_offset, relocs[i].r_info, true, relocs[i].r_addend, slots);
+        }
+    } else {
+        auto relocs = reinterpret_cast<const ElfW(Rel) *>(table);
+        for (size_t i = 0; i < size / sizeof(ElfW(Rel)); i++) {
+            check_reloc(module, symbol, relocs[i].r_offset, relocs[i].r_info, false, 0, slots);
+        }
+    }
+}
+
+static intptr_t read_sleb128(const uint8_t *&p, const uint8_t *end) {
+    intptr_t result = 0;
+    unsigned shift = 0;
+    uint8_t byte = 0;
+    while (p < end) {
+        byte = *p++;
+        result |= (intptr_t) (byte & 0x7f) << shift;
+        shift += 7;
+        if (!(byte & 0x80)) break;
+    }
+    if (shift < sizeof(intptr_t) * 8 && (byte & 0x40)) result |= -((intptr_t) 1 << shift);
+    return result;
+}
+
+// Android packed relocations, see bionic/linker/linker_sleb128.h and linker_reloc_iterators.h
+static void scan_android_relocs(const HookModule &module, const char *symbol, SlotList &slots) {
+    if (module.android_rel == 0 || module.android_rel_size < 4) return;
+    auto p = reinterpret_cast<const uint8_t *>(module.android_rel);
+    const uint8_t *end = p + module.android_rel_size;
+    if (memcmp(p, "APS2", 4) != 0) return;
+    p += 4;
+
+    intptr_t remaining = read_sleb128(p, end);
+    ElfW(Addr) offset = read_sleb128(p, end);
+    uintptr_t info = 0;
+    intptr_t addend = 0;  // delta encoded like the offset, zero in groups without addends
+    while (remaining > 0 && p < end) {
+        intptr_t group_size = read_sleb128(p, end);
+        intptr_t group_flags = read_sleb128(p, end);
+        intptr_t group_offset_delta = 0;
+        if (group_flags & RELOCATION_GROUPED_BY_OFFSET_DELTA_FLAG) group_offset_delta = read_sleb128(p, end);
+        if (group_flags & RELOCATION_GROUPED_BY_INFO_FLAG) info = read_sleb128(p, end);
+        bool has_addend = module.android_rel_is_rela && (group_flags & RELOCATION_GROUP_HAS_ADDEND_FLAG);
+        if (has_addend && (group_flags & RELOCATION_GROUPED_BY_ADDEND_FLAG)) addend += read_sleb128(p, end);
+        if (!has_addend) addend = 0;
+
+        for (intptr_t i = 0; i < group_size; i++) {
+            if (group_flags & RELOCATION_GROUPED_BY_OFFSET_DELTA_FLAG) {
+                offset += group_offset_delta;
+            } else {
+                offset += read_sleb128(p, end);
+            }
+            if (!(group_flags & RELOCATION_GROUPED_BY_INFO_FLAG)) info = read_sleb128(p, end);
+            if (has_addend && !(group_flags & RELOCATION_GROUPED_BY_ADDEND_FLAG)) addend += read_sleb128(p, end);
+            check_reloc(module, symbol, offset, info, module.android_rel_is_rela, addend, slots);
+        }
+        remaining -= group_size;
+    }
+}
+
+static bool in_relro(const HookModule &module, uintptr_t addr) {
+    for (size_t i = 0; i < module.phnum; i++) {
+        const ElfW(Phdr) &phdr = module.phdr[i];
+        if (phdr.p_type != PT_GNU_RELRO) continue;
+        uintptr_t start = module.load_bias + phdr.p_vaddr;
+        if (addr >= start && addr < start + phdr.p_memsz) return true;
+    }
+    return false;
+}
+
+static bool contains(const HookModule &module, uintptr_t addr) {
+    for (size_t i = 0; i < module.phnum; i++) {
+        const ElfW(Phdr) &phdr = module.phdr[i];
+        if (phdr.p_type != PT_LOAD) continue;
+        uintptr_t start = module.load_bias + phdr.p_vaddr;
+        if (addr >= start && addr < start + phdr.p_memsz) return true;
+    }
+    return false;
+}
+
+// Writes new_func into every slot. RELRO pages are made writable one contiguous run at a time and
+// sealed again afterwards; each slot is swapped with a single atomic store.
+static void patch_slots(const HookModule &module, SlotList &slots, HookRequest &request) {
+    std::sort(slots.slots, slots.slots + slots.count);
+    const uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+    pthread_mutex_lock(&patch_lock);
+    size_t i = 0;
+    while (i < slots.count) {
+        bool relro = in_relro(module, slots.slots[i]);
+        uintptr_t run_start = slots.slots[i] & ~(page_size - 1);
+        uintptr_t run_end = run_start + page_size;
+        size_t j = i + 1;
+        while (j < slots.count && in_relro(module, slots.slots[j]) == relro &&
+               (slots.slots[j] & ~(page_size - 1)) <= run_end) {
+            run_end = (slots.slots[j] & ~(page_size - 1)) + page_size;
+            j++;
+        }
+
+        if (relro && mprotect(reinterpret_cast<void *>(run_start), run_end - run_start, PROT_READ | PROT_WRITE) != 0) {
+            i = j;
+            continue;
+        }
+        for (size_t k = i; k < j; k++) {
+            auto slot = reinterpret_cast<void **>(slots.slots[k]);
+            void *previous = __atomic_exchange_n(slot, request.new_func, __ATOMIC_SEQ_CST);
+            if (!request.has_old_func) {
+                request.old_func = previous;
+                request.has_old_func = true;
+            }
+            request.patched++;
+        }
+        if (relro) mprotect(reinterpret_cast<void *>(run_start), run_end - run_start, PROT_READ);
+        i = j;
+    }
+    pthread_mutex_unlock(&patch_lock);
+}
+
+// False if the module has more slots for the symbol than PLT_HOOK_MAX_SLOTS, it is left unpatched
+static bool hook_module(HookModule &module, HookRequest &request) {
+    if (contains(module, (uintptr_t) request.new_func)) return true;
+    if (!parse_dynamic(module)) return true;
+
+    SlotList slots{};
+    scan_relocs(module, request.symbol, module.jmprel, module.jmprel_size, module.jmprel_is_rela, slots);
+    scan_relocs(module, request.symbol, module.rela, module.rela_size, true, slots);
+    scan_relocs(module, request.symbol, module.rel, module.rel_size, false, slots);
+    scan_android_relocs(module, request.symbol, slots);
+
+    if (slots.overflow) return false;
+    if (slots.count > 0) patch_slots(module, slots, request);
+    return true;
+}
+
+static int plt_hook_iterate_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void) size;
+    if (info->dlpi_addr == 0 || info->dlpi_name == nullptr) return 0;
+
+    HookModule module{};
+    module.load_bias = info->dlpi_addr;
+    module.phdr = info->dlpi_phdr;
+    module.phnum = info->dlpi_phnum;
+    auto request = static_cast<HookRequest *>(arg);
+    if (!hook_module(module, *request)) request->overflow = true;
+    return 0;
+}
+
+int plt_hook(const char *symbol, void *new_func, void **old_func) {
+    if (symbol == nullptr || new_func == nullptr) return -1;
+
+    HookRequest request{symbol, new_func, nullptr, false, 0, false};
+    xdl_iterate_phdr(plt_hook_iterate_cb, &request, XDL_DEFAULT);
+    if (old_func != nullptr && request.has_old_func) *old_func = request.old_func;
+    return request.overflow ? -1 : request.patched;
+}
+
+int plt_hook_module(void *handle, const char *symbol, void *new_func, void **old_func) {
+    if (handle == nullptr || symbol == nullptr || new_func == nullptr) return -1;
+
+    xdl_info_t info;
+    if (xdl_info(handle, XDL_DI_DLINFO, &info) != 0) return -1;
+
+    HookModule module{};
+    module.load_bias = (uintptr_t) info.dli_fbase;
+    module.phdr = info.dlpi_phdr;
+    module.phnum = info.dlpi_phnum;
+
+    HookRequest request{symbol, new_func, nullptr, false, 0, false};
+    if (!hook_module(module, request)) return -1;
+    if (old_func != nullptr && request.has_old_func) *old_func = request.old_func;
+    return request.patched;
+}
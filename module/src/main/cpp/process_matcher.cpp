@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "process_matcher.h"
+
+// An NFA state is a position in patterns: the rules, each followed by a NUL, which is the
+// accepting position of its rule. A DFA state is a sorted set of positions.
+using PositionSet = std::vector<uint32_t>;
+
+namespace {
+
+struct Compiler {
+    std::string patterns;
+    const uint8_t *classes;
+
+    // A star also matches nothing: the position after it is reached too
+    void close(PositionSet &set) const {
+        for (size_t i = 0; i < set.size(); i++) {
+            if (patterns[set[i]] == '*') set.push_back(set[i] + 1);
+        }
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+
+    PositionSet step(const PositionSet &set, uint cls) const {
+        PositionSet result;
+        for (uint32_t position : set) {
+            char c = patterns[position];
+            if (c == '*') {
+                result.push_back(position);
+            } else if (c == '?' || (c != '\0' && cls != 0 && classes[(uint8_t) c] == cls)) {
+                result.push_back(position + 1);
+            }
+        }
+        close(result);
+        return result;
+    }
+
+    bool accepts(const PositionSet &set) const {
+        return std::any_of(set.begin(), set.end(), [this](uint32_t position) { return patterns[position] == '\0'; });
+    }
+};
+
+}
+
+// The process name part of the rule after "<package>:", empty if the rule is the package itself.
+// False if the rule is neither.
+static bool process_suffix(std::string_view rule, std::string_view package, std::string_view &suffix) {
+    // A glob in the package would let a rule select other packages
+    if (package.find_first_of("*?") != std::string_view::npos) return false;
+    if (rule == package) {
+        suffix = {};
+        return true;
+    }
+    if (rule.starts_with(package) && rule.size() > package.size() && rule[package.size()] == ':') {
+        rule.remove_prefix(package.size());
+    }
+    if (rule.size() < 2 || rule[0] != ':') return false;
+    suffix = rule;
+    return true;
+}
+
+static std::string_view next_rule(std::string_view &rules) {
+    size_t end = std::min(rules.find(' '), rules.size());
+    std::string_view rule = rules.substr(0, end);
+    rules.remove_prefix(std::min(end + 1, rules.size()));
+    return rule;
+}
+
+std::string_view ProcessMatcher::invalid_rule(std::string_view rules, std::string_view package) {
+    while (!rules.empty()) {
+        std::string_view rule = next_rule(rules), suffix;
+        if (!rule.empty() && !process_suffix(rule, package, suffix)) return rule;
+    }
+    return {};
+}
+
+bool ProcessMatcher::compile(std::string_view rules, std::string_view package) {
+    memset(classes, 0, sizeof(classes));
+    class_count = 1;
+    next.assign(1, 0);
+    accepting.assign(1, false);
+    start = 0;
+
+    Compiler compiler{std::string(), classes};
+    PositionSet initial;
+    while (!rules.empty()) {
+        std::string_view rule = next_rule(rules), suffix;
+        if (rule.empty()) continue;
+        if (!process_suffix(rule, package, suffix)) {
+            compile("", package);
+            return false;
+        }
+
+        initial.push_back(compiler.patterns.size());
+        compiler.patterns.append(package);
+        compiler.patterns.append(suffix);
+        compiler.patterns.push_back('\0');
+    }
+    for (char c : compiler.patterns) {
+        if (c == '*' || c == '?' || c == '\0' || classes[(uint8_t) c] != 0) continue;
+        classes[(uint8_t) c] = class_count++;
+    }
+
+    compiler.close(initial);
+    if (initial.empty()) return true;
+
+    // Subset construction, state 0 is the empty set
+    std::map<PositionSet, uint16_t> ids{{PositionSet(), 0}};
+    std::vector<PositionSet> states{PositionSet()};
+    ids.emplace(initial, 1);
+    states.push_back(initial);
+    for (size_t state = 1; state < states.size(); state++) {
+        next.resize(states.size() * class_count, 0);
+        for (uint cls = 0; cls < class_count; cls++) {
+            PositionSet target = compiler.step(states[state], cls);
+            auto [it, added] = ids.emplace(target, (uint16_t) states.size());
+            if (added) {
+                if (states.size() == PROCESS_MATCHER_MAX_STATES) {
+                    compile("", package);
+                    return false;
+                }
+                states.push_back(std::move(target));
+            }
+            next[state * class_count + cls] = it->second;
+        }
+    }
+    next.resize(states.size() * class_count, 0);
+
+    accepting.resize(states.size());
+    for (size_t state = 0; state < states.size(); state++) accepting[state] = compiler.accepts(states[state]);
+    start = 1;
+    return true;
+}
+
+bool ProcessMatcher::matches(std::string_view process) const {
+    uint16_t state = start;
+    for (char c : process) {
+        state = next[state * class_count + classes[(uint8_t) c]];
+        if (state == 0) return false;
+    }
+    return accepting[state];
+}
@@ -0,0 +1,335 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "profiler.h"
+#include "unwinder.h"
+#include "log.h"
+#include "xdl.h"
+
+#define PROFILER_RING_SAMPLES 64      // per thread, must be a power of two
+#define PROFILER_DRAIN_INTERVAL_US 100000
+#define PROFILER_SCAN_EVERY 10        // drains between /proc/self/task scans
+#define PROFILER_FLUSH_EVERY 50       // drains between folded output rewrites
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Linux per-thread CPU clock id, see MAKE_THREAD_CPUCLOCK in the kernel's posix-timers.h
+#define PROFILER_THREAD_CPUCLOCK(tid) ((~(clockid_t) (tid) << 3) | 4 | 2)
+
+struct Sample {
+    uint32_t depth;
+    uintptr_t pcs[UNWIND_MAX_FRAMES];
+};
+
+// Single producer (the sampled thread, from its signal handler), single consumer (the drain thread).
+struct SampleRing {
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+    // Threads are found in /proc/self/task, without a pthread_t to ask for their stack. The first
+    // sample leaves its sp, the drain thread looks up the mapping holding it and publishes it as the
+    // stack the unwinder may read. Until then samples only hold the interrupted pc.
+    std::atomic<uintptr_t> first_sp{0};
+    std::atomic<bool> has_stack{false};
+    UnwindStack stack{};
+    Sample samples[PROFILER_RING_SAMPLES];
+};
+
+struct ThreadSampler {
+    pid_t tid;
+    timer_t timer;
+    SampleRing *ring;
+    bool seen;
+};
+
+struct ProfilerState {
+    std::string output_path;
+    long interval_ns;
+    pthread_t thread;
+    pid_t drain_tid;
+    std::atomic<bool> running{false};
+    std::vector<ThreadSampler> samplers;
+    std::vector<SampleRing *> retired;
+    void *xdl_cache = nullptr;
+    std::unordered_map<uintptr_t, std::string> frame_names;
+    std::unordered_map<std::string, uint64_t> folded;
+    uint64_t dropped = 0;
+    struct sigaction old_action{};
+};
+
+static ProfilerState *profiler;
+// Set by a PROFILER_STOP_REQUEST, the drain thread hands the stop to a thread of its own
+static std::atomic<bool> stop_requested{false};
+
+static void profiler_signal_handler(int signo, siginfo_t *info, void *ucontext) {
+    (void) signo;
+    if (info != nullptr && info->si_code == SI_QUEUE && info->si_value.sival_int == PROFILER_STOP_REQUEST) {
+        stop_requested.store(true, std::memory_order_relaxed);
+        return;
+    }
+    if (info == nullptr || info->si_code != SI_TIMER) return;
+    auto ring = static_cast<SampleRing *>(info->si_value.sival_ptr);
+    if (ring == nullptr) return;
+
+    int saved_errno = errno;
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= PROFILER_RING_SAMPLES) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        UnwindStack stack{};
+        if (ring->has_stack.load(std::memory_order_acquire)) {
+            stack = ring->stack;
+        } else if (ring->first_sp.load(std::memory_order_relaxed) == 0) {
+            ring->first_sp.store(unwind_stack_pointer(ucontext), std::memory_order_relaxed);
+        }
+        Sample &sample = ring->samples[head & (PROFILER_RING_SAMPLES - 1)];
+        sample.depth = (uint32_t) unwind_from_ucontext(ucontext, stack, sample.pcs, UNWIND_MAX_FRAMES);
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+    errno = saved_errno;
+}
+
+static bool add_sampler(pid_t tid) {
+    auto ring = new SampleRing();
+
+    struct sigevent sev{};
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_value.sival_ptr = ring;
+    sev.sigev_notify_thread_id = tid;
+
+    timer_t timer;
+    if (timer_create(PROFILER_THREAD_CPUCLOCK(tid), &sev, &timer) != 0) {
+        delete ring;
+        return false;
+    }
+
+    struct itimerspec spec{};
+    spec.it_interval.tv_sec = profiler->interval_ns / 1000000000L;
+    spec.it_interval.tv_nsec = profiler->interval_ns % 1000000000L;
+    spec.it_value = spec.it_interval;
+    timer_settime(timer, 0, &spec, nullptr);
+
+    profiler->samplers.push_back({tid, timer, ring, true});
+    return true;
+}
+
+// Arms a timer for every new thread and retires the ones of exited threads.
+static void scan_threads() {
+    for (auto &sampler : profiler->samplers) sampler.seen = false;
+
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == nullptr) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] == '.') continue;
+        pid_t tid = atoi(entry->d_name);
+        if (tid == profiler->drain_tid) continue;
+
+        bool known = false;
+        for (auto &sampler : profiler->samplers) {
+            if (sampler.tid == tid) {
+                sampler.seen = known = true;
+                break;
+            }
+        }
+        if (!known) add_sampler(tid);
+    }
+    closedir(dir);
+
+    // A signal may still be queued for a dead thread, so rings are freed one scan later.
+    for (auto ring : profiler->retired) delete ring;
+    profiler->retired.clear();
+
+    auto &samplers = profiler->samplers;
+    for (size_t i = 0; i < samplers.size();) {
+        if (samplers[i].seen) {
+            i++;
+            continue;
+        }
+        timer_delete(samplers[i].timer);
+        profiler->retired.push_back(samplers[i].ring);
+        samplers[i] = samplers.back();
+        samplers.pop_back();
+    }
+
+    unwind_refresh_modules();
+}
+
+static const std::string &frame_name(uintptr_t pc) {
+    auto it = profiler->frame_names.find(pc);
+    if (it != profiler->frame_names.end()) return it->second;
+
+    char buf[512];
+    xdl_info_t info;
+    if (xdl_addr(reinterpret_cast<void *>(pc), &info, &profiler->xdl_cache) && info.dli_fname != nullptr) {
+        const char *basename = strrchr(info.dli_fname, '/');
+        basename = basename ? basename + 1 : info.dli_fname;
+        if (info.dli_sname != nullptr) {
+            snprintf(buf, sizeof(buf), "%s`%s", basename, info.dli_sname);
+        } else {
+            snprintf(buf, sizeof(buf), "%s`0x%zx", basename, (size_t) (pc - (uintptr_t) info.dli_fbase));
+        }
+    } else {
+        snprintf(buf, sizeof(buf), "0x%zx", (size_t) pc);
+    }
+    return profiler->frame_names.emplace(pc, buf).first->second;
+}
+
+// Publishes the stack of every thread that left the sp of its first sample: the mapping holding it
+static void find_stacks() {
+    std::vector<SampleRing *> pending;
+    for (auto &sampler : profiler->samplers) {
+        SampleRing *ring = sampler.ring;
+        if (!ring->has_stack.load(std::memory_order_relaxed) && ring->first_sp.load(std::memory_order_relaxed) != 0) {
+            pending.push_back(ring);
+        }
+    }
+    if (pending.empty()) return;
+
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps == nullptr) return;
+    char line[512];
+    bool line_start = true;
+    while (fgets(line, sizeof(line), maps) != nullptr) {
+        // the rest of a line longer than the buffer is not a mapping
+        bool is_line = line_start;
+        line_start = strchr(line, '\n') != nullptr;
+        unsigned long long start, end;
+        if (!is_line || sscanf(line, "%llx-%llx", &start, &end) != 2) continue;
+        for (SampleRing *ring : pending) {
+            uintptr_t sp = ring->first_sp.load(std::memory_order_relaxed);
+            if (sp < start || sp >= end) continue;
+            ring->stack = {(uintptr_t) start, (uintptr_t) end};
+            ring->has_stack.store(true, std::memory_order_release);
+        }
+    }
+    fclose(maps);
+}
+
+static void drain_rings() {
+    find_stacks();
+    std::string stack;
+    for (auto &sampler : profiler->samplers) {
+        SampleRing *ring = sampler.ring;
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            const Sample &sample = ring->samples[tail & (PROFILER_RING_SAMPLES - 1)];
+            if (sample.depth == 0) continue;
+
+            stack.clear();
+            for (uint32_t i = sample.depth; i > 0; i--) {
+                if (!stack.empty()) stack += ';';
+                stack += frame_name(sample.pcs[i - 1]);
+            }
+            profiler->folded[stack]++;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+        profiler->dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+}
+
+static void flush_folded() {
+    std::string tmp_path = profiler->output_path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "w");
+    if (file == nullptr) {
+        LOGE("Profiler cannot write %s", tmp_path.c_str());
+        return;
+    }
+    for (const auto &[stack, count] : profiler->folded) {
+        fprintf(file, "%s %llu\n", stack.c_str(), (unsigned long long) count);
+    }
+    fclose(file);
+    rename(tmp_path.c_str(), profiler->output_path.c_str());
+}
+
+static void *stop_thread(void *arg) {
+    (void) arg;
+    profiler_stop();
+    return nullptr;
+}
+
+static void *profiler_thread(void *arg) {
+    (void) arg;
+    profiler->drain_tid = (pid_t) syscall(SYS_gettid);
+
+    for (uint64_t round = 0; profiler->running.load(std::memory_order_acquire); round++) {
+        if (round % PROFILER_SCAN_EVERY == 0) scan_threads();
+        usleep(PROFILER_DRAIN_INTERVAL_US);
+        drain_rings();
+        if (round % PROFILER_FLUSH_EVERY == PROFILER_FLUSH_EVERY - 1) flush_folded();
+        // profiler_stop() joins this thread, so it runs on another one
+        pthread_t stopper;
+        if (stop_requested.load(std::memory_order_relaxed) &&
+            pthread_create(&stopper, nullptr, stop_thread, nullptr) == 0) {
+            pthread_detach(stopper);
+            break;
+        }
+    }
+
+    for (auto &sampler : profiler->samplers) timer_delete(sampler.timer);
+    drain_rings();
+    flush_folded();
+    LOGD("Profiler stopped, %zu unique stacks, %llu samples dropped", profiler->folded.size(),
+         (unsigned long long) profiler->dropped);
+    return nullptr;
+}
+
+bool profiler_start(const char *output_path, uint hz) {
+    if (profiler != nullptr || output_path == nullptr) return false;
+    if (hz == 0) hz = PROFILER_DEFAULT_HZ;
+
+    profiler = new ProfilerState();
+    stop_requested.store(false, std::memory_order_relaxed);
+    profiler->output_path = output_path;
+    profiler->interval_ns = 1000000000L / hz;
+
+    struct sigaction action{};
+    action.sa_sigaction = profiler_signal_handler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &profiler->old_action);
+
+    unwind_refresh_modules();
+    profiler->running.store(true, std::memory_order_release);
+    if (pthread_create(&profiler->thread, nullptr, profiler_thread, nullptr) != 0) {
+        sigaction(SIGPROF, &profiler->old_action, nullptr);
+        delete profiler;
+        profiler = nullptr;
+        return false;
+    }
+    LOGD("Profiler started at %u Hz, output: %s", hz, output_path);
+    return true;
+}
+
+void profiler_stop() {
+    if (profiler == nullptr) return;
+
+    profiler->running.store(false, std::memory_order_release);
+    pthread_join(profiler->thread, nullptr);
+    // Signals still pending for the deleted timers must not reach SIG_DFL, which would kill the app.
+    if (profiler->old_action.sa_handler == SIG_DFL) profiler->old_action.sa_handler = SIG_IGN;
+    sigaction(SIGPROF, &profiler->old_action, nullptr);
+
+    for (auto &sampler : profiler->samplers) delete sampler.ring;
+    for (auto ring : profiler->retired) delete ring;
+    xdl_addr_clean(&profiler->xdl_cache);
+    delete profiler;
+    profiler = nullptr;
+}
@@ -0,0 +1,110 @@
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+
+#include "chunk_queue.h"
+#include "test.h"
+
+// Records of [uint32 size][uint32 sequence][filler], each consume() must start at a record
+class CheckingConsumer : public ChunkConsumer {
+public:
+    void consume(const uint8_t *data, size_t size) override {
+        if (delay_us > 0) usleep(delay_us);
+        while (size > 0) {
+            uint32_t record[2];
+            CHECK(size >= sizeof(record));
+            memcpy(record, data, sizeof(record));
+            CHECK(record[0] >= sizeof(record) && record[0] <= size);
+            CHECK(record[1] == next_sequence);
+            next_sequence++;
+            data += record[0];
+            size -= record[0];
+        }
+        consumed.store(next_sequence, std::memory_order_release);
+    }
+
+    void flushed() override { flushes.fetch_add(1, std::memory_order_relaxed); }
+
+    uint32_t next_sequence = 0;
+    std::atomic<uint32_t> consumed{0};
+    std::atomic<uint32_t> flushes{0};
+    useconds_t delay_us = 0;
+};
+
+static uint32_t sequence = 0;
+
+static void add_record(ChunkQueue &queue, uint32_t size) {
+    uint8_t *p = queue.reserve(size);
+    uint32_t record[2] = {size, sequence++};
+    memcpy(p, record, sizeof(record));
+    memset(p + sizeof(record), 0x5a, size - sizeof(record));
+    queue.commit(size);
+}
+
+static double wait_consumed(const CheckingConsumer &consumer, uint32_t count) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 2000 && consumer.consumed.load(std::memory_order_acquire) < count; i++) usleep(1000);
+    CHECK(consumer.consumed.load(std::memory_order_acquire) == count);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Everything arrives in order, whole records per consume(), flush() runs flushed() once
+static void check_throughput() {
+    CheckingConsumer consumer;
+    sequence = 0;
+    uint64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        ChunkQueue queue(consumer, 64 * 1024, 8, 50, 4);
+        for (uint32_t i = 0; i < 2000000; i++) {
+            uint32_t size = 8 + (i * 37 % 300);
+            add_record(queue, size);
+            bytes += size;
+        }
+        queue.flush();
+        CHECK(consumer.consumed == sequence);
+        CHECK(consumer.flushes == 1);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(consumer.flushes == 2);  // the destructor flushes too
+    printf("chunk_queue: %u records, %.1f MB/s\n", sequence, (double) bytes / 1e6 / seconds);
+}
+
+// A lone record is taken after two quiet idle periods, a trickle after max_idle_ticks at the latest
+static void check_idle() {
+    CheckingConsumer consumer;
+    sequence = 0;
+    ChunkQueue queue(consumer, 64 * 1024, 8, 20, 4);
+    add_record(queue, 100);
+    double ms = wait_consumed(consumer, 1);
+    CHECK(ms >= 20 && ms < 500);
+
+    // One record every 10 ms keeps the current chunk busy
+    auto start = std::chrono::steady_clock::now();
+    while (consumer.consumed.load(std::memory_order_acquire) == 1) {
+        add_record(queue, 100);
+        usleep(10000);
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+    }
+    CHECK(queue.stalls() == 0);
+}
+
+// A slow consumer makes the producer wait, without losing or reordering anything
+static void check_stalls() {
+    CheckingConsumer consumer;
+    consumer.delay_us = 2000;
+    sequence = 0;
+    ChunkQueue queue(consumer, 4096, 2, 50, 4);
+    for (int i = 0; i < 200; i++) add_record(queue, 1000);
+    queue.flush();
+    CHECK(consumer.consumed == 200);
+    CHECK(queue.stalls() > 0);
+}
+
+int main() {
+    check_throughput();
+    check_idle();
+    check_stalls();
+    return 0;
+}
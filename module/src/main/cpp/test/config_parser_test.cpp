@@ -0,0 +1,139 @@
+#include <cstring>
+#include <string>
+
+#include "config_parser.h"
+#include "nlohmann/json.hpp"
+#include "test.h"
+
+// As the tool writes it
+static const char written_config[] = R"({
+    "package": {
+        "name": "com.example.app",
+        "delay": 300,
+        "process": ":push com.example.*",
+        "mode": {
+            "config": false,
+            "profile": true
+        }
+    },
+    "generation": 42
+}
+)";
+
+static ConfigStatus parse(const std::string &text, GadgetConfig &config) {
+    return parse_gadget_config(text.data(), text.size(), config);
+}
+
+static void check_parse() {
+    GadgetConfig config{};
+    CHECK(parse(written_config, config));
+    CHECK(strcmp(config.package_name, "com.example.app") == 0);
+    CHECK(config.delay == 300);
+    CHECK(strcmp(config.process_rules, ":push com.example.*") == 0);
+    CHECK(!config.config_mode);
+    CHECK(config.profile);
+    CHECK(config.generation == 42 && config.has_generation);
+
+    // A hand written config: optional fields absent, unknown keys and values skipped
+    CHECK(parse(R"({"extra": [1, {"a": null}, "x"], "package": {"mode": {"config": true, "other": 1.5e3},
+                    "name": "aé😀", "delay": 0}})", config));
+    CHECK(strcmp(config.package_name, "a\xc3\xa9\xf0\x9f\x98\x80") == 0);
+    CHECK(config.config_mode && !config.profile);
+    CHECK(config.process_rules[0] == '\0');
+    CHECK(config.generation == 0 && !config.has_generation);
+
+    // Optional fields of another type count as absent
+    CHECK(parse(R"({"package": {"name": "a", "delay": 1, "process": 5, "mode": {"config": true, "profile": "yes"}},
+                    "generation": -1})", config));
+    CHECK(config.process_rules[0] == '\0' && !config.profile && !config.has_generation);
+    // A later null unsets an earlier value
+    CHECK(parse(R"({"package": {"name": "a", "delay": 1, "mode": {"config": true}}, "generation": 7,
+                    "generation": null})", config));
+    CHECK(!config.has_generation && config.generation == 0);
+}
+
+static void check_error(const std::string &text, ConfigError error, const char *field) {
+    GadgetConfig config{};
+    set_package_name(config, "unchanged");
+    ConfigStatus status = parse(text, config);
+    CHECK(status.error == error);
+    CHECK(field == nullptr ? status.field == nullptr : status.field != nullptr && strcmp(status.field, field) == 0);
+    CHECK(status.offset <= text.size());
+    CHECK(strcmp(config.package_name, "unchanged") == 0);  // only written on success
+}
+
+static void check_errors() {
+    check_error("", ConfigError::syntax, nullptr);
+    check_error(R"({"package": {"name": "a",})", ConfigError::syntax, nullptr);
+    check_error(std::string(written_config) + "x", ConfigError::syntax, nullptr);
+    check_error(R"({"package": {"name": "a", "delay": 1, "mode": {}}})", ConfigError::missing_field,
+                "package.mode.config");
+    check_error(R"({"package": {"name": null, "delay": 1, "mode": {"config": true}}})", ConfigError::missing_field,
+                "package.name");
+    check_error(R"({"package": {"name": "a", "delay": "1", "mode": {"config": true}}})", ConfigError::wrong_type,
+                "package.delay");
+    check_error(R"({"package": {"name": "a", "delay": -1, "mode": {"config": true}}})", ConfigError::wrong_type,
+                "package.delay");
+    check_error(R"({"package": {"name": "a", "delay": 4294967296, "mode": {"config": true}}})",
+                ConfigError::out_of_range, "package.delay");
+    std::string long_name = R"({"package": {"name": ")" + std::string(CONFIG_PACKAGE_MAX, 'a') + R"("}})";
+    check_error(long_name, ConfigError::out_of_range, "package.name");
+    check_error(std::string(40, '[') + std::string(40, ']'), ConfigError::too_deep, nullptr);
+}
+
+// format_gadget_config() writes what parse_gadget_config() reads back, escapes included
+static void check_round_trip() {
+    GadgetConfig config{};
+    CHECK(parse(written_config, config));
+    char buf[1024];
+    size_t len = format_gadget_config(config, buf, sizeof(buf));
+    CHECK(len > 0 && std::string(buf, len) == written_config);
+    CHECK(format_gadget_config(config, buf, len) == 0);  // no room for the NUL
+
+    GadgetConfig odd{};
+    CHECK(set_package_name(odd, "quote\" backslash\\ tab\t nl\n bell\x07 \xc3\xa9"));
+    CHECK(set_process_rules(odd, ":a :b"));
+    odd.delay = UINT32_MAX;
+    odd.config_mode = true;
+    odd.generation = UINT64_MAX;
+    len = format_gadget_config(odd, buf, sizeof(buf));
+    CHECK(len > 0);
+    GadgetConfig parsed{};
+    CHECK(parse(std::string(buf, len), parsed));
+    CHECK(strcmp(parsed.package_name, odd.package_name) == 0);
+    CHECK(strcmp(parsed.process_rules, odd.process_rules) == 0);
+    CHECK(parsed.delay == odd.delay && parsed.config_mode && !parsed.profile);
+    CHECK(parsed.generation == UINT64_MAX && parsed.has_generation);
+    // nlohmann, which hand edits and older tools use, reads it the same way
+    auto json = nlohmann::json::parse(buf, buf + len, nullptr, false);
+    CHECK(!json.is_discarded());
+    CHECK(json["package"]["name"].get<std::string>() == odd.package_name);
+    CHECK(json["generation"].get<uint64_t>() == UINT64_MAX);
+}
+
+// The schema parser against a DOM parse and lookups of the same fields
+static void bench() {
+    std::string text = written_config;
+    GadgetConfig config{};
+    double schema_us = time_per_call_us(200000, [&] { CHECK(parse(text, config)); });
+    double dom_us = time_per_call_us(200000, [&] {
+        auto json = nlohmann::json::parse(text, nullptr, false);
+        const auto &package = json["package"];
+        set_package_name(config, package["name"].get<std::string>());
+        config.delay = package["delay"].get<uint>();
+        set_process_rules(config, package.value("process", ""));
+        config.config_mode = package["mode"]["config"].get<bool>();
+        config.profile = package["mode"].value("profile", false);
+        config.generation = json.value("generation", (uint64_t) 0);
+        CHECK(config.delay == 300);
+    });
+    printf("config: schema parser %.0f ns/parse, nlohmann DOM %.0f ns/parse\n", schema_us * 1000, dom_us * 1000);
+}
+
+int main() {
+    check_parse();
+    check_errors();
+    check_round_trip();
+    bench();
+    return 0;
+}
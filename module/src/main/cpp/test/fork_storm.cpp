@@ -0,0 +1,389 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config_parser.h"
+#include "package_table.h"
+#include "test.h"
+#include "../zygisk.hpp"
+
+// A boot storm of the module against its companion. Driver threads each fork one simulated app
+// process at a time, connected to the driver over a socketpair: the child loads the module with a
+// fake zygisk::Api and runs preAppSpecialize, the driver serves the connection with
+// zygisk_companion_entry() as zygiskd does, on a thread per connection. postAppSpecialize, which
+// loads the gadget, is not run. The companion reads a packages.list written by the harness.
+
+#define TARGET_PACKAGE "com.example.app"
+#define TARGET_UID 10123
+#define OTHER_APPS 300
+#define OTHER_APP_UID 11000  // + n for com.app<n>
+#define ISOLATED_UID 99000   // + n, isolated processes run under uids of no package
+#define GADGET_SIZE (4 * 1024 * 1024)
+
+#if defined(__aarch64__)
+#define GADGET_NAME "frida-gadget-16.1.4-android-arm64.so"
+#elif defined(__x86_64__)
+#define GADGET_NAME "frida-gadget-16.1.4-android-x86_64.so"
+#elif defined(__arm__)
+#define GADGET_NAME "frida-gadget-16.1.4-android-arm.so"
+#else
+#define GADGET_NAME "frida-gadget-16.1.4-android-x86.so"
+#endif
+
+enum class Outcome : uint8_t {
+    pending,
+    skipped,   // told not to inject, the module asked to be unloaded
+    gadget_fd, // handed a read only fd of the gadget memfd
+    copied,    // told to inject without an fd
+    failed,    // the child did not finish
+};
+
+// Written by the children into shared memory
+struct LaunchResult {
+    int64_t latency_ns;    // preAppSpecialize in the app process
+    int64_t companion_ns;  // companion_handler for its connection, written by the driver
+    int64_t companion_cpu_ns;
+    Outcome outcome;
+    uint8_t name_conversions;  // GetStringUTFChars calls, only processes that may be the target convert their name
+};
+
+// The Zygisk side of one simulated app process
+struct FakeZygisk {
+    int companion_fd = -1;
+    const char *module_dir = nullptr;
+    zygisk::internal::module_abi *module = nullptr;
+    int exempted_fd = -1;
+    bool unload = false;
+    uint8_t name_conversions = 0;
+};
+
+static FakeZygisk fake;
+
+static zygisk::internal::api_table fake_api = {
+        .impl = &fake,
+        .registerModule = [](zygisk::internal::api_table *, zygisk::internal::module_abi *abi) {
+            fake.module = abi;
+            return true;
+        },
+        .hookJniNativeMethods = nullptr,
+        .pltHookRegister = nullptr,
+        .exemptFd = [](int fd) {
+            fake.exempted_fd = fd;
+            return true;
+        },
+        .pltHookCommit = nullptr,
+        .connectCompanion = [](void *) { return fake.companion_fd; },
+        .setOption = [](void *, zygisk::Option option) {
+            if (option == zygisk::DLCLOSE_MODULE_LIBRARY) fake.unload = true;
+        },
+        .getModuleDir = [](void *) { return open(fake.module_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC); },
+        .getFlags = [](void *) { return 0u; },
+};
+
+// A jstring is the C string of the name here
+static const JNINativeInterface fake_jni = {
+        .GetStringUTFChars = [](JNIEnv *, jstring string, jboolean *) {
+            fake.name_conversions++;
+            return (const char *) string;
+        },
+        .ReleaseStringUTFChars = [](JNIEnv *, jstring, const char *) {},
+};
+
+// Laid out like zygisk::AppSpecializeArgs, which cannot be constructed: Zygisk passes its own struct
+struct SpecializeArgs {
+    jint &uid;
+    jint &gid;
+    jintArray &gids;
+    jint &runtime_flags;
+    jobjectArray &rlimits;
+    jint &mount_external;
+    jstring &se_info;
+    jstring &nice_name;
+    jstring &instruction_set;
+    jstring &app_data_dir;
+    jintArray *fds_to_ignore;
+    jboolean *is_child_zygote;
+    jboolean *is_top_app;
+    jobjectArray *pkg_data_info_list;
+    jobjectArray *whitelisted_data_info_list;
+    jboolean *mount_data_dirs;
+    jboolean *mount_storage_dirs;
+};
+
+static_assert(sizeof(SpecializeArgs) == sizeof(void *) * 17);
+
+// In the forked child
+static void run_app(int companion_fd, const char *module_dir, jint uid, const char *process, LaunchResult &result) {
+    auto start = std::chrono::steady_clock::now();
+    fake.companion_fd = companion_fd;
+    fake.module_dir = module_dir;
+    JNIEnv env{&fake_jni};
+    zygisk_module_entry(&fake_api, &env);
+    CHECK(fake.module != nullptr);
+
+    jint gid = uid, runtime_flags = 0, mount_external = 0;
+    jintArray gids = nullptr;
+    jobjectArray rlimits = nullptr;
+    jstring se_info = nullptr, instruction_set = nullptr, app_data_dir = nullptr;
+    auto nice_name = (jstring) const_cast<char *>(process);
+    SpecializeArgs args{uid, gid, gids, runtime_flags, rlimits, mount_external, se_info, nice_name,
+                        instruction_set, app_data_dir, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+    fake.module->preAppSpecialize(fake.module->impl, reinterpret_cast<zygisk::AppSpecializeArgs *>(&args));
+    result.latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    result.name_conversions = fake.name_conversions;
+
+    struct stat st{};
+    if (fake.unload) {
+        result.outcome = Outcome::skipped;
+    } else if (fake.exempted_fd >= 0 && fstat(fake.exempted_fd, &st) == 0 && st.st_size == GADGET_SIZE &&
+               (fcntl(fake.exempted_fd, F_GETFL) & O_ACCMODE) == O_RDONLY) {
+        result.outcome = Outcome::gadget_fd;
+    } else {
+        result.outcome = Outcome::copied;
+    }
+}
+
+struct Launch {
+    jint uid;
+    std::string process;
+    Outcome expected;
+    bool converts_name;
+};
+
+// One in ten launches is the target app, one in ten its :push process, one in ten its :remote
+// process that the rules leave out, one in ten an isolated process of the target, one in ten an
+// isolated process of another app, the rest other apps. Only the launches the uid cannot rule out
+// get as far as converting their name.
+static std::vector<Launch> storm_launches(size_t count) {
+    std::vector<Launch> launches;
+    for (size_t i = 0; i < count; i++) {
+        jint n = (jint) (i % OTHER_APPS);
+        switch (i % 10) {
+            case 0:
+                launches.push_back({TARGET_UID, TARGET_PACKAGE, Outcome::gadget_fd, true});
+                break;
+            case 1:
+                launches.push_back({TARGET_UID, TARGET_PACKAGE ":push", Outcome::gadget_fd, true});
+                break;
+            case 2:
+                launches.push_back({TARGET_UID, TARGET_PACKAGE ":remote", Outcome::skipped, true});
+                break;
+            case 3:
+                launches.push_back({ISOLATED_UID + n, TARGET_PACKAGE ":sandboxed_process0", Outcome::gadget_fd, true});
+                break;
+            case 4:
+                launches.push_back({ISOLATED_UID + n, "com.app" + std::to_string(n) + ":sandboxed_process0",
+                                    Outcome::skipped, true});
+                break;
+            default:
+                launches.push_back({OTHER_APP_UID + n, "com.app" + std::to_string(n), Outcome::skipped, false});
+        }
+    }
+    return launches;
+}
+
+static void write_file(const std::string &path, const void *data, size_t size) {
+    std::string tmp = path + ".tmp" + std::to_string(gettid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    CHECK(fd >= 0 && write(fd, data, size) == (ssize_t) size);
+    close(fd);
+    // Replaced like the tool does, a new inode for every version
+    CHECK(rename(tmp.c_str(), path.c_str()) == 0);
+}
+
+static void write_config(const std::string &module_dir, uint64_t generation) {
+    GadgetConfig config{};
+    CHECK(set_package_name(config, TARGET_PACKAGE));
+    CHECK(set_process_rules(config, TARGET_PACKAGE " :push :sandboxed_process*"));
+    config.delay = 0;
+    config.generation = generation;
+    config.has_generation = true;
+    char buf[1024];
+    size_t len = format_gadget_config(config, buf, sizeof(buf));
+    CHECK(len > 0);
+    write_file(module_dir + "/config", buf, len);
+}
+
+struct StormOptions {
+    std::string module_dir;
+    size_t concurrency;
+    // Rewrite the config before every launch, so every connection reads, parses and compiles it
+    bool churn = false;
+    bool verbose = false;
+};
+
+static int64_t thread_cpu_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double cpu_ms(const struct rusage &usage) {
+    return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+           (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+// Runs launches with options.concurrency in flight, prints the statistics under label
+static void storm(const char *label, const std::vector<Launch> &launches, const StormOptions &options) {
+    size_t count = launches.size();
+    auto results = static_cast<LaunchResult *>(mmap(nullptr, count * sizeof(LaunchResult), PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+    CHECK(results != MAP_FAILED);
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> generation{1};
+    std::mutex config_lock;
+
+    struct rusage self_before{}, children_before{}, self_after{}, children_after{};
+    getrusage(RUSAGE_SELF, &self_before);
+    getrusage(RUSAGE_CHILDREN, &children_before);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> drivers;
+    for (size_t t = 0; t < options.concurrency; t++) {
+        drivers.emplace_back([&] {
+            for (size_t i; (i = next.fetch_add(1)) < count;) {
+                if (options.churn) {
+                    // In generation order, so the companion never sees an older one after a newer
+                    std::lock_guard<std::mutex> guard(config_lock);
+                    write_config(options.module_dir, generation.fetch_add(1) + 1);
+                }
+                int sv[2];
+                CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == 0);
+                pid_t pid = fork();
+                CHECK(pid >= 0);
+                if (pid == 0) {
+                    close(sv[0]);
+                    if (!options.verbose) {
+                        int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+                        dup2(null, STDERR_FILENO);
+                    }
+                    run_app(sv[1], options.module_dir.c_str(), launches[i].uid, launches[i].process.c_str(),
+                            results[i]);
+                    _exit(0);
+                }
+                close(sv[1]);
+                auto companion_start = std::chrono::steady_clock::now();
+                int64_t companion_cpu_start = thread_cpu_ns();
+                zygisk_companion_entry(sv[0]);
+                results[i].companion_cpu_ns = thread_cpu_ns() - companion_cpu_start;
+                results[i].companion_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - companion_start).count();
+                close(sv[0]);
+                int status;
+                CHECK(waitpid(pid, &status, 0) == pid);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) results[i].outcome = Outcome::failed;
+            }
+        });
+    }
+    for (auto &driver : drivers) driver.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    getrusage(RUSAGE_SELF, &self_after);
+    getrusage(RUSAGE_CHILDREN, &children_after);
+
+    std::vector<int64_t> latencies, companion;
+    int64_t companion_cpu_ns = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (results[i].outcome != launches[i].expected) {
+            fprintf(stderr, "%s: launch %zu of %s: outcome %d, expected %d\n", label, i, launches[i].process.c_str(),
+                    (int) results[i].outcome, (int) launches[i].expected);
+            exit(1);
+        }
+        if (results[i].name_conversions != (launches[i].converts_name ? 1 : 0)) {
+            fprintf(stderr, "%s: launch %zu of %s: process name converted %u times\n", label, i,
+                    launches[i].process.c_str(), results[i].name_conversions);
+            exit(1);
+        }
+        latencies.push_back(results[i].latency_ns);
+        companion.push_back(results[i].companion_ns);
+        companion_cpu_ns += results[i].companion_cpu_ns;
+    }
+    munmap(results, count * sizeof(LaunchResult));
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(companion.begin(), companion.end());
+    printf("%s: %zu launches, %zu in flight, %.0f launches/s\n", label, count, options.concurrency,
+           (double) count / seconds);
+    printf("%s: preAppSpecialize p50 %.0f us, p99 %.0f us, max %.0f us; companion_handler p50 %.0f us, p99 %.0f us\n",
+           label, (double) latencies[count / 2] / 1e3, (double) latencies[count * 99 / 100] / 1e3,
+           (double) latencies.back() / 1e3, (double) companion[count / 2] / 1e3,
+           (double) companion[count * 99 / 100] / 1e3);
+    double parent_ms = cpu_ms(self_after) - cpu_ms(self_before);
+    double children_ms = cpu_ms(children_after) - cpu_ms(children_before);
+    printf("%s: CPU %.0f ms in the companion and drivers, %.0f ms in the app processes, %.1f us per launch, "
+           "%.1f us of it in companion_handler\n", label, parent_ms, children_ms,
+           (parent_ms + children_ms) * 1e3 / (double) count, (double) companion_cpu_ns / 1e3 / (double) count);
+}
+
+static std::string make_module_dir(const std::string &dir, const char *name, bool with_gadget) {
+    std::string module_dir = dir + "/" + name;
+    CHECK(mkdir(module_dir.c_str(), 0755) == 0);
+    write_config(module_dir, 1);
+    if (with_gadget) {
+        std::vector<uint8_t> gadget(GADGET_SIZE);
+        uint32_t x = 12345;
+        for (auto &byte : gadget) byte = (uint8_t) ((x = x * 1103515245 + 12345) >> 24);
+        write_file(module_dir + "/" GADGET_NAME, gadget.data(), gadget.size());
+    }
+    return module_dir;
+}
+
+// As PackageManager writes it: the target and the other apps, with the user 0 uids
+static void write_packages_list() {
+    std::string list = TARGET_PACKAGE " " + std::to_string(TARGET_UID) + " 0 /data/user/0/" TARGET_PACKAGE
+                       " default:targetSdkVersion=34 3003\n";
+    for (int n = 0; n < OTHER_APPS; n++) {
+        std::string name = "com.app" + std::to_string(n);
+        list += name + " " + std::to_string(OTHER_APP_UID + n) + " 0 /data/user/0/" + name +
+                " default:targetSdkVersion=34 none\n";
+    }
+    if (mkdir(PACKAGES_LIST_DIR, 0755) != 0) CHECK(errno == EEXIST);
+    write_file(PACKAGES_LIST_DIR "/" PACKAGES_LIST_NAME, list.data(), list.size());
+}
+
+static void remove_module_dir(const std::string &module_dir) {
+    unlink((module_dir + "/config").c_str());
+    unlink((module_dir + "/" GADGET_NAME).c_str());
+    CHECK(rmdir(module_dir.c_str()) == 0);
+}
+
+// fork_storm [launches] [in flight] [-v]: 2000 launches, one per hardware thread by default.
+// Runs the storm with a steady config, where connections are served from the companion's caches,
+// then with a config rewritten before every launch.
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000;
+    size_t concurrency = argc > 2 ? strtoul(argv[2], nullptr, 10) : std::max(1u, std::thread::hardware_concurrency());
+    bool verbose = argc > 3 && strcmp(argv[3], "-v") == 0;
+    CHECK(count >= 10 && concurrency > 0);
+
+    const char *tmp = getenv("TMPDIR");
+    std::string dir = std::string(tmp != nullptr ? tmp : "/tmp") + "/fork_storm.XXXXXX";
+    CHECK(mkdtemp(dir.data()) != nullptr);
+    write_packages_list();
+
+    // Without a gadget the target is not told to inject
+    std::string empty_dir = make_module_dir(dir, "empty", false);
+    storm("no gadget", {{TARGET_UID, TARGET_PACKAGE, Outcome::skipped, true}}, {empty_dir, 1, false, verbose});
+    remove_module_dir(empty_dir);
+
+    std::string module_dir = make_module_dir(dir, "module", true);
+    std::vector<Launch> launches = storm_launches(count);
+    storm("cached", launches, {module_dir, concurrency, false, verbose});
+    storm("config churn", launches, {module_dir, concurrency, true, verbose});
+    remove_module_dir(module_dir);
+    rmdir(dir.c_str());
+    unlink(PACKAGES_LIST_DIR "/" PACKAGES_LIST_NAME);
+    rmdir(PACKAGES_LIST_DIR);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef ZYGISK_GADGET_HOST_ANDROID_DLEXT_H
+#define ZYGISK_GADGET_HOST_ANDROID_DLEXT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+enum {
+    ANDROID_DLEXT_RESERVED_ADDRESS = 0x1,
+    ANDROID_DLEXT_USE_LIBRARY_FD = 0x10,
+    ANDROID_DLEXT_USE_LIBRARY_FD_OFFSET = 0x20,
+    ANDROID_DLEXT_FORCE_LOAD = 0x40,
+};
+
+typedef struct {
+    uint64_t flags;
+    void *reserved_addr;
+    size_t reserved_size;
+    int relro_fd;
+    int library_fd;
+    off64_t library_fd_offset;
+    void *library_namespace;
+} android_dlextinfo;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Weak: glibc has no dlext, xdl falls back to plain dlopen() when it is null
+void *android_dlopen_ext(const char *filename, int flags, const android_dlextinfo *extinfo) __attribute__((weak));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZYGISK_GADGET_HOST_ANDROID_DLEXT_H
@@ -0,0 +1,41 @@
+#ifndef ZYGISK_GADGET_HOST_ANDROID_LOG_H
+#define ZYGISK_GADGET_HOST_ANDROID_LOG_H
+
+// The liblog surface the module and tool use, printed to stderr by host_compat.c
+
+typedef enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+} android_LogPriority;
+
+typedef enum log_id {
+    LOG_ID_MIN = 0,
+    LOG_ID_MAIN = 0,
+    LOG_ID_RADIO = 1,
+    LOG_ID_EVENTS = 2,
+    LOG_ID_SYSTEM = 3,
+    LOG_ID_CRASH = 4,
+    LOG_ID_STATS = 5,
+    LOG_ID_SECURITY = 6,
+    LOG_ID_KERNEL = 7,
+    LOG_ID_MAX,
+} log_id_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ZYGISK_GADGET_HOST_ANDROID_LOG_H
@@ -0,0 +1,41 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "android/api-level.h"
+#include "android/log.h"
+
+int android_get_device_api_level(void) {
+    return HOST_ANDROID_API_LEVEL;
+}
+
+// One write() per line without stdio: lines of concurrent threads stay whole, and a process forked
+// while another thread logs does not inherit a held stdio lock
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+    static const char priorities[] = "??VDIWEFS";
+    char line[1024];
+    int prefix = snprintf(line, sizeof(line), "%c %s: ", priorities[prio >= 0 && prio <= ANDROID_LOG_SILENT ? prio : 0],
+                          tag);
+    va_list args;
+    va_start(args, fmt);
+    // Leaves room for the newline in place of the NUL, a longer message is cut
+    size_t room = sizeof(line) - prefix - 1;
+    int n = vsnprintf(line + prefix, room, fmt, args);
+    va_end(args);
+    size_t len = prefix + (n < 0 ? 0 : (size_t) n < room ? (size_t) n : room - 1);
+    line[len++] = '\n';
+    write(STDERR_FILENO, line, len);
+    return n;
+}
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size) {
+    size_t length = strlen(src);
+    if (size > 0) {
+        size_t n = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return length;
+}
+#endif
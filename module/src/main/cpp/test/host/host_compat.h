@@ -0,0 +1,32 @@
+#ifndef ZYGISK_GADGET_HOST_COMPAT_H
+#define ZYGISK_GADGET_HOST_COMPAT_H
+
+// Force-included into every host translation unit: the bionic extensions the sources rely on.
+
+#include <string.h>
+
+// bionic's <sys/cdefs.h> brings these into every file
+#include "android/api-level.h"
+
+#define HOST_ANDROID_API_LEVEL 30
+
+#ifndef __predict_false
+#define __predict_false(exp) __builtin_expect((exp) != 0, 0)
+#define __predict_true(exp) __builtin_expect((exp) != 0, 1)
+#endif
+
+#ifndef ELF_ST_TYPE
+#define ELF_ST_TYPE(info) ((info) & 0xf)
+#endif
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+#ifdef __cplusplus
+extern "C" {
+#endif
+size_t strlcpy(char *dst, const char *src, size_t size);
+#ifdef __cplusplus
+}
+#endif
+#endif
+
+#endif //ZYGISK_GADGET_HOST_COMPAT_H
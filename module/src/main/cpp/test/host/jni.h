@@ -0,0 +1,44 @@
+#ifndef ZYGISK_GADGET_HOST_JNI_H
+#define ZYGISK_GADGET_HOST_JNI_H
+
+// The JNI surface of zygisk.hpp and the module. JNIEnv calls through a function table like the
+// real one, which a host harness fills in.
+
+#include <stdint.h>
+
+typedef int32_t jint;
+typedef int64_t jlong;
+typedef uint8_t jboolean;
+typedef struct _jobject *jobject;
+typedef jobject jclass;
+typedef jobject jstring;
+typedef jobject jintArray;
+typedef jobject jobjectArray;
+
+typedef struct {
+    const char *name;
+    const char *signature;
+    void *fnPtr;
+} JNINativeMethod;
+
+struct _JNIEnv;
+typedef _JNIEnv JNIEnv;
+
+struct JNINativeInterface {
+    const char *(*GetStringUTFChars)(JNIEnv *env, jstring string, jboolean *is_copy);
+    void (*ReleaseStringUTFChars)(JNIEnv *env, jstring string, const char *utf);
+};
+
+struct _JNIEnv {
+    const JNINativeInterface *functions;
+
+    const char *GetStringUTFChars(jstring string, jboolean *is_copy) {
+        return functions->GetStringUTFChars(this, string, is_copy);
+    }
+
+    void ReleaseStringUTFChars(jstring string, const char *utf) {
+        functions->ReleaseStringUTFChars(this, string, utf);
+    }
+};
+
+#endif //ZYGISK_GADGET_HOST_JNI_H
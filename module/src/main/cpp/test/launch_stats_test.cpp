@@ -0,0 +1,69 @@
+#include <string>
+
+#include "launch_stats.h"
+#include "test.h"
+
+static void check_main_process() {
+    LaunchStats stats;
+    stats.on_app_start();
+    stats.on_process_start(100, 10, 0);
+    stats.on_gadget_result(101, 10, 100000000, true);  // another pid
+    CHECK(stats.completed() == 0);
+    stats.on_gadget_result(100, 10, 250000000, true);
+    CHECK(stats.completed() == 1);
+    CHECK(stats.last_latency_us() == 250000);
+    stats.on_gadget_result(100, 11, 0, true);  // reported once only
+    CHECK(stats.completed() == 1);
+
+    stats.on_app_start();
+    stats.on_process_start(200, 20, 0);
+    stats.on_gadget_result(200, 20, 1000000, false);
+    CHECK(stats.completed() == 2);
+    CHECK(stats.failures() == 1);
+}
+
+// Processes of one run report in any order, a restart fails what is still pending
+static void check_process_rules() {
+    LaunchStats stats;
+    stats.on_app_start();
+    stats.on_process_start(100, 10, 0);
+    stats.on_process_start(101, 10, 500000000);
+    stats.on_process_start(102, 11, 0);
+    stats.on_gadget_result(101, 10, 600000000, true);
+    CHECK(stats.completed() == 1);
+    CHECK(stats.last_latency_us() == 100000);
+    stats.on_gadget_result(100, 10, 300000000, true);
+    CHECK(stats.completed() == 2);
+    CHECK(stats.last_latency_us() == 300000);
+
+    stats.on_app_start();  // 102 never reported
+    CHECK(stats.completed() == 3);
+    CHECK(stats.failures() == 1);
+
+    // The same pid started again without a report
+    stats.on_process_start(300, 30, 0);
+    stats.on_process_start(300, 31, 0);
+    stats.on_gadget_result(300, 31, 2000000, true);
+    CHECK(stats.completed() == 5);
+    CHECK(stats.failures() == 2);
+    CHECK(stats.last_latency_us() == 2000);
+}
+
+static void check_report() {
+    LaunchStats stats;
+    CHECK(stats.report() == "0 launches, 0 loaded, 0 failed (0.0%)\n");
+    for (pid_t pid = 1; pid <= 100; pid++) {
+        stats.on_process_start(pid, 0, 0);
+        stats.on_gadget_result(pid, 0, (uint32_t) pid * 1000000, true);
+    }
+    std::string report = stats.report();
+    CHECK(report.starts_with("100 launches, 100 loaded, 0 failed (0.0%)\n"));
+    CHECK(report.find("min 1.0, p50 50.0, p95 95.0, p99 99.0, max 100.0") != std::string::npos);
+}
+
+int main() {
+    check_main_process();
+    check_process_rules();
+    check_report();
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <pthread.h>
+
+#include "plt_hook_test_libs.h"
+#include "test.h"
+#include "xdl.h"
+
+#define PLT_HOOK_TEST_ROUNDS 20000
+
+static int replacement(int x) {
+    return x + 100;
+}
+
+static void check_slot_kinds(void *handle) {
+    auto original = target_pointer();
+    const char *inside = inside_pointer();
+    CHECK(call_target(1) == 2);
+
+    // GLOB_DAT and the table slot, the call goes through one of them or its own JUMP_SLOT
+    void *old_func = nullptr;
+    int patched = plt_hook_module(handle, "hook_target", (void *) replacement, &old_func);
+    CHECK(patched == 2 || patched == 3);
+    CHECK(old_func == (void *) original);
+    CHECK(call_target(1) == 101);
+    CHECK(target_pointer() == replacement);
+    CHECK(table_entry() == replacement);
+    CHECK(inside_pointer() == inside);
+
+    CHECK(plt_hook_module(handle, "hook_target", old_func, nullptr) == patched);
+    CHECK(call_target(1) == 2);
+    CHECK(target_pointer() == original);
+    CHECK(table_entry() == original);
+}
+
+static void check_overflow(void *handle) {
+    auto original = many_entry(0);
+    CHECK(plt_hook_module(handle, "hook_many", (void *) replacement, nullptr) == -1);
+    CHECK(plt_hook("hook_many", (void *) replacement, nullptr) == -1);
+    for (int i = 0; i <= PLT_HOOK_MAX_SLOTS; i++) CHECK(many_entry(i) == original);
+}
+
+// Both symbols have their GOT slots on the same RELRO page of the target
+static void *hook_other_loop(void *arg) {
+    (void) arg;
+    for (int i = 0; i < PLT_HOOK_TEST_ROUNDS; i++) {
+        void *old_func = nullptr;
+        CHECK(plt_hook("hook_other", (void *) replacement, &old_func) == 1);
+        CHECK(plt_hook("hook_other", old_func, nullptr) == 1);
+    }
+    return nullptr;
+}
+
+static void check_concurrent_hooks(void *handle) {
+    pthread_t thread;
+    CHECK(pthread_create(&thread, nullptr, hook_other_loop, nullptr) == 0);
+    for (int i = 0; i < PLT_HOOK_TEST_ROUNDS; i++) {
+        void *old_func = nullptr;
+        CHECK(plt_hook_module(handle, "hook_target", (void *) replacement, &old_func) > 0);
+        CHECK(plt_hook_module(handle, "hook_target", old_func, nullptr) > 0);
+    }
+    pthread_join(thread, nullptr);
+    CHECK(call_target(1) == 2);
+    CHECK(call_other(1) == 2);
+}
+
+int main() {
+    void *handle = xdl_open("libplt_hook_test_target.so", XDL_DEFAULT);
+    CHECK(handle != nullptr);
+    check_slot_kinds(handle);
+    check_overflow(handle);
+    check_concurrent_hooks(handle);
+    xdl_close(handle);
+    return 0;
+}
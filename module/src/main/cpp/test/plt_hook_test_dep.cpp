@@ -0,0 +1,13 @@
+#include "plt_hook_test_libs.h"
+
+int hook_target(int x) {
+    return x + 1;
+}
+
+int hook_other(int x) {
+    return x + 1;
+}
+
+int hook_many(int x) {
+    return x + 1;
+}
@@ -0,0 +1,20 @@
+#ifndef ZYGISK_GADGET_PLT_HOOK_TEST_LIBS_H
+#define ZYGISK_GADGET_PLT_HOOK_TEST_LIBS_H
+
+#include "plt_hook.h"
+
+// libplt_hook_test_dep.so defines the hooked symbols, x + 1 each
+extern "C" int hook_target(int x);
+extern "C" int hook_other(int x);
+extern "C" int hook_many(int x);
+
+// libplt_hook_test_target.so imports them through every kind of slot the engine knows. Its data is
+// read through functions, the executable would otherwise read its own copy of it.
+extern "C" int call_target(int x);         // JUMP_SLOT, or the GLOB_DAT one
+extern "C" int call_other(int x);          // JUMP_SLOT
+extern "C" int (*target_pointer())(int);   // GLOB_DAT
+extern "C" int (*table_entry())(int);      // ABS without addend
+extern "C" const char *inside_pointer();   // ABS with addend 4, never patched
+extern "C" int (*many_entry(int i))(int);  // PLT_HOOK_MAX_SLOTS + 1 ABS slots, more than the engine takes
+
+#endif //ZYGISK_GADGET_PLT_HOOK_TEST_LIBS_H
@@ -0,0 +1,35 @@
+#include "plt_hook_test_libs.h"
+
+#define MANY_8 hook_many, hook_many, hook_many, hook_many, hook_many, hook_many, hook_many, hook_many
+
+int call_target(int x) {
+    return hook_target(x);
+}
+
+int call_other(int x) {
+    return hook_other(x);
+}
+
+int (*target_pointer())(int) {
+    return &hook_target;
+}
+
+// Writable, so the compiler keeps the slots instead of folding their reads into the GOT's
+int (*target_table[1])(int) = {hook_target};
+
+const char *target_inside = (const char *) &hook_target + 4;
+
+int (*many_table[PLT_HOOK_MAX_SLOTS + 1])(int) = {MANY_8, MANY_8, MANY_8, MANY_8, MANY_8, MANY_8, MANY_8, MANY_8,
+                                                  hook_many};
+
+int (*table_entry())(int) {
+    return target_table[0];
+}
+
+const char *inside_pointer() {
+    return target_inside;
+}
+
+int (*many_entry(int i))(int) {
+    return many_table[i];
+}
@@ -0,0 +1,289 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <android/log.h>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "log_capture.h"
+#include "log_source.h"
+#include "log_writer.h"
+#include "logcat.h"
+#include "test.h"
+
+#define TARGET_PACKAGE "com.example.app"
+
+// Writes records the way RecordingSource stores what logd delivered
+class CaptureWriter {
+public:
+    explicit CaptureWriter(const char *path) : file(fopen(path, "wbe")) {
+        CHECK(file != nullptr);
+        fwrite(LOG_CAPTURE_MAGIC, 1, LOG_CAPTURE_MAGIC_LEN, file);
+    }
+    ~CaptureWriter() { fclose(file); }
+
+    void line(int32_t pid, uint8_t prio, const char *tag, const char *message) {
+        std::string payload(1, (char) prio);
+        payload.append(tag).push_back('\0');
+        payload.append(message).push_back('\0');
+        record(LOG_ID_MAIN, pid, 10000, payload);
+    }
+
+    // am_proc_start as system_server logs it
+    void proc_start(int32_t pid, const char *process) {
+        std::string payload;
+        append_int32(payload, 30014);
+        payload.push_back(3);  // list
+        payload.push_back(6);
+        for (int32_t value : {0, pid, 10123}) {
+            payload.push_back(0);  // int
+            append_int32(payload, value);
+        }
+        for (const char *str : {process, "activity", TARGET_PACKAGE "/.MainActivity"}) {
+            payload.push_back(2);  // string
+            append_int32(payload, (int32_t) strlen(str));
+            payload.append(str);
+        }
+        record(LOG_ID_EVENTS, 1000, 1000, payload);
+    }
+
+    uint64_t records = 0;
+    uint64_t bytes = LOG_CAPTURE_MAGIC_LEN;
+
+private:
+    static void append_int32(std::string &out, int32_t value) {
+        out.append((const char *) &value, sizeof(value));
+    }
+
+    void record(uint32_t lid, int32_t pid, uint32_t uid, const std::string &payload) {
+        logger_entry entry{(uint16_t) payload.size(), sizeof(logger_entry), pid, (uint32_t) pid,
+                           (uint32_t) (1700000000 + now_us / 1000000), (uint32_t) (now_us % 1000000 * 1000), lid, uid};
+        fwrite(&entry, 1, sizeof(entry), file);
+        fwrite(payload.data(), 1, payload.size(), file);
+        now_us += 700;
+        records++;
+        bytes += sizeof(entry) + payload.size();
+    }
+
+    FILE *file;
+    uint64_t now_us = 0;
+};
+
+// Decompresses an LZ4 frame as LogCapture writes it: no content size, block checksums
+static std::string lz4_decompress_frame(const std::string &frame) {
+    std::string out;
+    auto load32 = [&](size_t pos) {
+        uint32_t value;
+        CHECK(pos + 4 <= frame.size());
+        memcpy(&value, frame.data() + pos, sizeof(value));
+        return value;
+    };
+    CHECK(load32(0) == 0x184d2204);
+    size_t pos = 7;
+    while (uint32_t header = load32(pos)) {
+        uint32_t size = header & 0x7fffffff;
+        auto src = reinterpret_cast<const uint8_t *>(frame.data() + pos + 4);
+        CHECK(pos + 8 + size <= frame.size());
+        if (header & 0x80000000) {
+            out.append((const char *) src, size);
+        } else {
+            size_t block_start = out.size();
+            for (const uint8_t *p = src, *end = src + size; p < end;) {
+                uint8_t token = *p++;
+                size_t len = token >> 4;
+                if (len == 15) do len += *p; while (*p++ == 255);
+                out.append((const char *) p, len);
+                p += len;
+                if (p == end) break;
+                size_t offset = p[0] | p[1] << 8;
+                p += 2;
+                CHECK(offset > 0 && offset <= out.size() - block_start);
+                len = token & 15;
+                if (len == 15) do len += *p; while (*p++ == 255);
+                for (size_t i = 0; i < len + 4; i++) out.push_back(out[out.size() - offset]);
+            }
+        }
+        pos += 8 + size;
+    }
+    return out;
+}
+
+static void interrupt_handler(int) {
+    logcat_interrupt();
+}
+
+// Replays in a child, logcat() keeps its filters and the stdout writer for the process lifetime.
+// With interrupt_ms, the child gets SIGINT after that long and handles it like main() does.
+static double replay(const std::string &capture, const char *output, uint interrupt_ms = 0,
+                     const std::string &capture_dir = "") {
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    CHECK(pid >= 0);
+    if (pid == 0) {
+        int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) _exit(1);
+        signal(SIGINT, interrupt_handler);
+        LogcatOptions options;
+        options.package = TARGET_PACKAGE;
+        options.replay_path = capture;
+        options.tags = {"Frida"};
+        options.greps = {"needle"};
+        options.capture_dir = capture_dir;
+        logcat(options);
+        _exit(logcat_interrupted() ? 2 : 0);
+    }
+    if (interrupt_ms > 0) {
+        usleep(interrupt_ms * 1000);
+        kill(pid, SIGINT);
+    }
+    int status;
+    CHECK(waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == (interrupt_ms > 0 ? 2 : 0));
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::string read_file(const std::string &path) {
+    std::string data;
+    FILE *file = fopen(path.c_str(), "rbe");
+    CHECK(file != nullptr);
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) data.append(buf, n);
+    fclose(file);
+    return data;
+}
+
+// The target's lines, the ZygiskGadget lines and the --tag/--grep matches are followed, nothing else
+static void check_filtering(const std::string &dir) {
+    std::string capture = dir + "/filter.zglog", output = dir + "/filter.txt";
+    {
+        CaptureWriter writer(capture.c_str());
+        writer.line(4242, 4, "App", "before the start");
+        writer.proc_start(4242, TARGET_PACKAGE);
+        writer.line(4242, 4, "App", "hello from the target");
+        writer.line(1, 4, "Noise", "skip me");
+        writer.line(2, 3, "FridaAgent", "tag match");
+        writer.line(3, 5, "Other", "a needle in the message");
+        writer.proc_start(4300, "com.other.app");
+        writer.line(4300, 4, "App", "other app");
+        writer.line(4242, 4, "ZygiskGadget", "Frida-gadget loaded");
+    }
+    replay(capture, output.c_str());
+    std::string text = read_file(output);
+    CHECK(text.find(TARGET_PACKAGE " started, pid 4242") != std::string::npos);
+    CHECK(text.find("hello from the target") != std::string::npos);
+    CHECK(text.find("tag match") != std::string::npos);
+    CHECK(text.find("a needle in the message") != std::string::npos);
+    CHECK(text.find("Frida-gadget loaded") != std::string::npos);
+    CHECK(text.find("before the start") == std::string::npos);
+    CHECK(text.find("skip me") == std::string::npos);
+    CHECK(text.find("other app") == std::string::npos);
+    unlink(capture.c_str());
+    unlink(output.c_str());
+}
+
+// --capture keeps what the follower kept: the segment replays to the same output, and the
+// index points at each block with the time of its first record
+static void check_capture(const std::string &dir) {
+    std::string capture = dir + "/capture.zglog", output = dir + "/capture.txt";
+    std::string segments = dir + "/segments", extracted = dir + "/extracted.zglog";
+    {
+        CaptureWriter writer(capture.c_str());
+        writer.proc_start(4242, TARGET_PACKAGE);
+        char message[64];
+        for (int i = 0; i < 20000; i++) {
+            snprintf(message, sizeof(message), "line %d of the target", i);
+            writer.line(i % 3 == 0 ? 4242 : 1, 4, "App", message);
+        }
+    }
+    replay(capture, output.c_str(), 0, segments);
+    std::string segment = read_file(segments + "/1.zglog.lz4");
+    std::string data = lz4_decompress_frame(segment);
+    CHECK(data.starts_with(std::string(LOG_CAPTURE_MAGIC, LOG_CAPTURE_MAGIC_LEN)));
+    FILE *file = fopen(extracted.c_str(), "wbe");
+    CHECK(file != nullptr && fwrite(data.data(), 1, data.size(), file) == data.size());
+    fclose(file);
+    replay(extracted, (output + ".2").c_str());
+    CHECK(read_file(output) == read_file(output + ".2"));
+    CHECK(read_file(output).find("line 19998 of the target") != std::string::npos);
+
+    std::string index = read_file(segments + "/1.idx");
+    CHECK(index.starts_with(LOG_CAPTURE_INDEX_MAGIC));
+    size_t blocks = (index.size() - LOG_CAPTURE_INDEX_MAGIC_LEN) / sizeof(LogCaptureIndexEntry);
+    CHECK(blocks > 1);
+    uint64_t previous = 0;
+    for (size_t i = 0; i < blocks; i++) {
+        LogCaptureIndexEntry entry;
+        memcpy(&entry, index.data() + LOG_CAPTURE_INDEX_MAGIC_LEN + i * sizeof(entry), sizeof(entry));
+        uint64_t time = (uint64_t) entry.sec * 1000000000 + entry.nsec;
+        CHECK(time >= previous && entry.sec >= 1700000000);
+        CHECK(entry.offset < segment.size());
+        previous = time;
+    }
+    printf("capture: %zu blocks, %zu bytes compressed to %zu\n", blocks, data.size(), segment.size());
+    for (const std::string &path : {capture, output, output + ".2", extracted, segments + "/1.zglog.lz4",
+                                    segments + "/1.idx"}) {
+        unlink(path.c_str());
+    }
+    rmdir(segments.c_str());
+}
+
+// A synthetic capture of size_mb: an app restart every 1000 records, a few percent of the
+// records from the target, the rest other processes
+static void bench(const std::string &dir, uint64_t size_mb) {
+    std::string capture = dir + "/bench.zglog";
+    static const char *tags[] = {"ActivityManager", "chatty", "WindowManager", "InputDispatcher", "ConnectivityService",
+                                 "BluetoothAdapter", "PackageManager", "SurfaceFlinger"};
+    uint64_t records, bytes;
+    {
+        CaptureWriter writer(capture.c_str());
+        char message[160];
+        int32_t target_pid = 10000;
+        for (uint64_t i = 0; writer.bytes < size_mb << 20; i++) {
+            if (i % 1000 == 0) {
+                writer.proc_start(++target_pid, TARGET_PACKAGE);
+            } else if (i % 1000 == 1) {
+                writer.line(target_pid, 4, "ZygiskGadget", "Frida-gadget loaded");
+            } else if (i % 32 == 0) {
+                snprintf(message, sizeof(message), "onResume frame %llu took %llu us", (unsigned long long) i,
+                         (unsigned long long) (i * 7 % 16000));
+                writer.line(target_pid, 3, "App", message);
+            } else {
+                snprintf(message, sizeof(message), "uid=%llu state changed to %llu, reason: scheduled job %llu finished",
+                         (unsigned long long) (i % 97), (unsigned long long) (i % 5), (unsigned long long) i);
+                writer.line((int32_t) (i % 500 + 100), (uint8_t) (2 + i % 5), tags[i % 8], message);
+            }
+        }
+        records = writer.records;
+        bytes = writer.bytes;
+    }
+    double seconds = replay(capture, "/dev/null");
+    printf("replay: %llu entries (%.1f MB) in %.3f s: %.0f entries/s, %.1f MB/s\n", (unsigned long long) records,
+           (double) bytes / 1e6, seconds, (double) records / seconds, (double) bytes / 1e6 / seconds);
+
+    // Ctrl + C stops the replay early, with the lines decoded so far written out whole
+    std::string output = dir + "/interrupted.txt";
+    uint interrupt_ms = (uint) (seconds * 1000 / 4) + 1;
+    double interrupted_seconds = replay(capture, output.c_str(), interrupt_ms);
+    std::string text = read_file(output);
+    CHECK(!text.empty() && text.back() == '\n');
+    CHECK(interrupted_seconds < seconds * 0.9 + 0.05);
+    printf("replay: interrupted after %u ms, %zu bytes written\n", interrupt_ms, text.size());
+    unlink(output.c_str());
+    unlink(capture.c_str());
+}
+
+// replay_bench [capture MB], 64 MB by default; several GB for a stable number
+int main(int argc, char **argv) {
+    const char *tmp = getenv("TMPDIR");
+    std::string dir = std::string(tmp != nullptr ? tmp : "/tmp") + "/replay_bench.XXXXXX";
+    CHECK(mkdtemp(dir.data()) != nullptr);
+    check_filtering(dir);
+    check_capture(dir);
+    bench(dir, argc > 1 ? strtoull(argv[1], nullptr, 10) : 64);
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef ZYGISK_GADGET_TEST_H
+#define ZYGISK_GADGET_TEST_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Host tests abort on the first failed check, ctest reports the message
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);   \
+            exit(1);                                                                        \
+        }                                                                                   \
+    } while (0)
+
+// Mean microseconds per call of fn over iterations calls
+template <typename Fn>
+static double time_per_call_us(size_t iterations, Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) fn();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double) iterations;
+}
+
+#endif //ZYGISK_GADGET_TEST_H
@@ -0,0 +1,95 @@
+#include <pthread.h>
+#include <ucontext.h>
+#include <cstdint>
+
+#include "test.h"
+#include "unwinder_test_frames.h"
+
+#if defined(__aarch64__)
+#define UC_SP(uc) (uc).uc_mcontext.sp
+#define UC_FP(uc) (uc).uc_mcontext.regs[29]
+#define UC_PC(uc) (uc).uc_mcontext.pc
+#else
+#define UC_SP(uc) (uc).uc_mcontext.gregs[REG_RSP]
+#define UC_FP(uc) (uc).uc_mcontext.gregs[REG_RBP]
+#define UC_PC(uc) (uc).uc_mcontext.gregs[REG_RIP]
+#endif
+
+// The CFI walk agrees with libgcc's from the first caller on, the leaf pcs differ by one call.
+// Only frames up to the executable are compared, the unwinder has no CFI for it.
+static void check_backtrace() {
+    uintptr_t unwound[UNWIND_MAX_FRAMES];
+    void *expected[UNWIND_MAX_FRAMES];
+    int expected_count = 0;
+    size_t unwound_count = frames_backtrace(unwound, expected, &expected_count);
+    CHECK(unwound_count >= 4);
+    CHECK(expected_count >= 4);
+    for (int i = 1; i < 4; i++) CHECK(unwound[i] == (uintptr_t) expected[i]);
+}
+
+// pcs no module covers, so every step follows the frame pointer chain
+static void check_frame_pointer_bounds() {
+    alignas(16) static uintptr_t stack[64];
+    alignas(16) static uintptr_t outside[4];
+    uintptr_t *frame0 = &stack[8];
+    uintptr_t *frame1 = &stack[16];
+    frame0[0] = (uintptr_t) frame1;
+    frame0[1] = 0x1100;
+    frame1[0] = (uintptr_t) outside;
+    frame1[1] = 0x1200;
+    outside[0] = (uintptr_t) &stack[32];
+    outside[1] = 0x1300;
+
+    ucontext_t uc{};
+    UC_SP(uc) = (uintptr_t) stack;
+    UC_FP(uc) = (uintptr_t) frame0;
+    UC_PC(uc) = 0x1000;
+    UnwindStack bounds{(uintptr_t) stack, (uintptr_t) (stack + 64)};
+    uintptr_t pcs[UNWIND_MAX_FRAMES];
+
+    // the chain leaves the stack at frame1, outside is never read
+    size_t count = unwind_from_ucontext(&uc, bounds, pcs, UNWIND_MAX_FRAMES);
+    CHECK(count == 3);
+    CHECK(pcs[0] == 0x1000 && pcs[1] == 0x1100 && pcs[2] == 0x1200);
+
+    // a frame straddling the top of the stack
+    UC_FP(uc) = (uintptr_t) &stack[63];
+    CHECK(unwind_from_ucontext(&uc, bounds, pcs, UNWIND_MAX_FRAMES) == 1);
+
+    // a frame pointer that is not one: pointing at an unmapped page
+    UC_FP(uc) = (uintptr_t) stack + (1 << 20);
+    CHECK(unwind_from_ucontext(&uc, bounds, pcs, UNWIND_MAX_FRAMES) == 1);
+
+    // an sp outside the stack
+    UC_SP(uc) = (uintptr_t) outside;
+    UC_FP(uc) = (uintptr_t) frame0;
+    CHECK(unwind_from_ucontext(&uc, bounds, pcs, UNWIND_MAX_FRAMES) == 1);
+
+    // without a stack only the pc
+    UC_SP(uc) = (uintptr_t) stack;
+    CHECK(unwind_from_ucontext(&uc, UnwindStack{}, pcs, UNWIND_MAX_FRAMES) == 1);
+}
+
+// What a profiler sample costs: unwinding a captured context of this thread
+static void *measure(void *arg) {
+    (void) arg;
+    UnwindStack stack{};
+    CHECK(unwind_current_stack(&stack));
+    uintptr_t pcs[UNWIND_MAX_FRAMES];
+    size_t count = 0;
+    double us = time_per_call_us(100000, [&] { count = frames_sample(stack, pcs); });
+    CHECK(count >= 2);
+    printf("unwind_from_ucontext: %zu frames, %.3f us per sample\n", count, us);
+    return nullptr;
+}
+
+int main() {
+    unwind_refresh_modules();
+    check_backtrace();
+    check_frame_pointer_bounds();
+
+    pthread_t thread;
+    CHECK(pthread_create(&thread, nullptr, measure, nullptr) == 0);
+    pthread_join(thread, nullptr);
+    return 0;
+}
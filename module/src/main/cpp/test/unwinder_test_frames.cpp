@@ -0,0 +1,29 @@
+#include <execinfo.h>
+#include <ucontext.h>
+
+#include "unwinder_test_frames.h"
+
+static size_t unwound_count;
+
+[[gnu::noinline]] static void leaf(uintptr_t *unwound, void **expected, int *expected_count) {
+    unwound_count = unwind_backtrace(unwound, UNWIND_MAX_FRAMES);
+    *expected_count = backtrace(expected, UNWIND_MAX_FRAMES);
+    __asm__ volatile("" ::: "memory");
+}
+
+[[gnu::noinline]] static void middle(uintptr_t *unwound, void **expected, int *expected_count) {
+    leaf(unwound, expected, expected_count);
+    __asm__ volatile("" ::: "memory");
+}
+
+size_t frames_backtrace(uintptr_t *unwound, void **expected, int *expected_count) {
+    middle(unwound, expected, expected_count);
+    __asm__ volatile("" ::: "memory");
+    return unwound_count;
+}
+
+size_t frames_sample(const UnwindStack &stack, uintptr_t *pcs) {
+    ucontext_t uc;
+    getcontext(&uc);
+    return unwind_from_ucontext(&uc, stack, pcs, UNWIND_MAX_FRAMES);
+}
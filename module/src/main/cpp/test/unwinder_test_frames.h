@@ -0,0 +1,18 @@
+#ifndef ZYGISK_GADGET_UNWINDER_TEST_FRAMES_H
+#define ZYGISK_GADGET_UNWINDER_TEST_FRAMES_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "unwinder.h"
+
+// The frames unwinder_test walks live in a shared object with the unwinder, like in the module:
+// xdl leaves the host executable out of its module list, its dlpi_name is empty.
+
+// unwind_backtrace() and glibc's backtrace() three calls deep
+size_t frames_backtrace(uintptr_t *unwound, void **expected, int *expected_count);
+
+// unwind_from_ucontext() of a context captured by getcontext()
+size_t frames_sample(const UnwindStack &stack, uintptr_t *pcs);
+
+#endif //ZYGISK_GADGET_UNWINDER_TEST_FRAMES_H
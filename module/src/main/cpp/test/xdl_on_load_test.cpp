@@ -0,0 +1,72 @@
+#include <dlfcn.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+
+#include "test.h"
+#include "xdl.h"
+
+struct Subscriber {
+    std::atomic<int> calls{0};
+    std::atomic<bool> running{false};
+    useconds_t delay_us = 0;
+    bool cancel_self = false;
+    const char *name = nullptr;  // a load of this module was reported
+    std::atomic<bool> seen{false};
+};
+
+static void on_load(const xdl_load_event_t *event, void *arg) {
+    auto *subscriber = (Subscriber *) arg;
+    subscriber->running = true;
+    subscriber->calls++;
+    if (subscriber->name != nullptr && strstr(event->name, subscriber->name) != nullptr) subscriber->seen = true;
+    if (subscriber->delay_us > 0) usleep(subscriber->delay_us);
+    if (subscriber->cancel_self) CHECK(xdl_on_load_cancel(on_load, arg) == 0);
+    subscriber->running = false;
+}
+
+template <typename Fn>
+static void wait_until(Fn &&done) {
+    for (int i = 0; i < 5000 && !done(); i++) usleep(1000);
+    CHECK(done());
+}
+
+// Canceled in the middle of a batch: cancel returns only once the callback has left
+static void check_cancel_waits(const char *library) {
+    Subscriber slow;
+    slow.delay_us = 20000;
+    Subscriber live;
+    live.name = strrchr(library, '/') + 1;
+    CHECK(xdl_on_load(on_load, &slow, XDL_ON_LOAD_REPLAY) == 0);
+    wait_until([&] { return slow.running.load(); });
+    CHECK(xdl_on_load_cancel(on_load, &slow) == 0);
+    CHECK(!slow.running);
+    int calls = slow.calls;
+
+    CHECK(xdl_on_load(on_load, &live, 0) == 0);
+    void *handle = dlopen(library, RTLD_NOW);
+    CHECK(handle != nullptr);
+    wait_until([&] { return live.seen.load(); });
+    CHECK(slow.calls == calls);
+    CHECK(xdl_on_load_cancel(on_load, &live) == 0);
+    CHECK(xdl_on_load_cancel(on_load, &live) == -1);
+    dlclose(handle);
+}
+
+// Canceled from its own callback: no deadlock, and no further call in the same batch
+static void check_cancel_from_callback() {
+    Subscriber self;
+    self.cancel_self = true;
+    CHECK(xdl_on_load(on_load, &self, XDL_ON_LOAD_REPLAY) == 0);
+    wait_until([&] { return self.calls > 0; });
+    usleep(50000);
+    CHECK(self.calls == 1);
+    CHECK(xdl_on_load_cancel(on_load, &self) == -1);
+}
+
+int main(int argc, char **argv) {
+    CHECK(argc == 2);
+    check_cancel_waits(argv[1]);
+    check_cancel_from_callback();
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <signal.h>
+
+#include "chunk_queue.h"
+
+ChunkQueue::ChunkQueue(ChunkConsumer &consumer, size_t chunk_size, uint32_t chunk_count, uint idle_ms,
+                       uint max_idle_ticks) :
+        consumer(consumer), chunk_size(chunk_size), chunk_count(chunk_count), idle_ms(idle_ms),
+        max_idle_ticks(max_idle_ticks), chunks(new Chunk[chunk_count]) {
+    for (uint32_t i = 0; i < chunk_count; i++) chunks[i].data = new uint8_t[chunk_size];
+    // Signals are handled by the decoding thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    thread = std::thread(&ChunkQueue::consume_loop, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+ChunkQueue::~ChunkQueue() {
+    flush();
+    stopping.store(true, std::memory_order_seq_cst);
+    wake_consumer();
+    thread.join();
+    for (uint32_t i = 0; i < chunk_count; i++) delete[] chunks[i].data;
+    delete[] chunks;
+}
+
+static void wake(std::atomic<uint32_t> &counter) {
+    counter.fetch_add(1, std::memory_order_seq_cst);
+    counter.notify_one();
+}
+
+uint8_t *ChunkQueue::reserve(size_t size) {
+    Chunk *chunk = &chunks[head.load(std::memory_order_relaxed) % chunk_count];
+    size_t len = chunk->len.load(std::memory_order_relaxed);
+    if (len + size > chunk_size) {
+        hand_over();
+        chunk = &chunks[head.load(std::memory_order_relaxed) % chunk_count];
+        len = 0;
+    }
+    return chunk->data + len;
+}
+
+void ChunkQueue::commit(size_t size) {
+    Chunk &chunk = chunks[head.load(std::memory_order_relaxed) % chunk_count];
+    chunk.len.store(chunk.len.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+// Queues chunks[head], waiting for the chunk after it to be free first if needed
+void ChunkQueue::hand_over() {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (chunks[h % chunk_count].len.load(std::memory_order_relaxed) == 0) return;
+    if (h + 1 - tail.load(std::memory_order_acquire) >= chunk_count) {
+        stall_count.fetch_add(1, std::memory_order_relaxed);
+        wait_for_consumer(flush_done.load(std::memory_order_relaxed), h + 1);
+    }
+    // Consumed, and the consumer only looks at it again once head reaches it
+    chunks[(h + 1) % chunk_count].len.store(0, std::memory_order_relaxed);
+    head.store(h + 1, std::memory_order_seq_cst);
+    wake_consumer();
+}
+
+void ChunkQueue::flush() {
+    hand_over();
+    uint32_t seq = flush_requested.load(std::memory_order_relaxed) + 1;
+    flush_requested.store(seq, std::memory_order_seq_cst);
+    wake_consumer();
+    wait_for_consumer(seq, head.load(std::memory_order_relaxed));
+}
+
+// Until flush_done reached flush_seq and chunk next_chunk is free
+void ChunkQueue::wait_for_consumer(uint32_t flush_seq, uint32_t next_chunk) {
+    auto done = [&] {
+        return flush_done.load(std::memory_order_seq_cst) == flush_seq &&
+               next_chunk - tail.load(std::memory_order_seq_cst) < chunk_count;
+    };
+    while (!done()) {
+        uint32_t wake_seq = producer_wake.load(std::memory_order_seq_cst);
+        producer_waiting.store(true, std::memory_order_seq_cst);
+        if (!done()) producer_wake.wait(wake_seq);
+        producer_waiting.store(false, std::memory_order_relaxed);
+    }
+}
+
+void ChunkQueue::wake_consumer() {
+    if (!consumer_waiting.load(std::memory_order_seq_cst)) return;
+    // Taking the mutex orders the notify after the consumer started waiting
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    consumer_wakeup.notify_one();
+}
+
+// After an idle period: takes what was committed to the current chunk, once the producer left it alone
+void ChunkQueue::take_idle(uint32_t t, size_t &idle_len, uint &ticks) {
+    if (head.load(std::memory_order_acquire) != t) return;
+    Chunk &chunk = chunks[t % chunk_count];
+    size_t len = chunk.len.load(std::memory_order_acquire);
+    if (len == chunk.consumed) {
+        ticks = 0;
+        return;
+    }
+    if (len != idle_len && ++ticks < max_idle_ticks) {
+        idle_len = len;
+        return;
+    }
+    consumer.consume(chunk.data + chunk.consumed, len - chunk.consumed);
+    chunk.consumed = len;
+    idle_len = len;
+    ticks = 0;
+}
+
+void ChunkQueue::consume_loop() {
+    size_t idle_len = 0;  // committed length of the current chunk at the previous idle period
+    uint ticks = 0;
+    while (true) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t != head.load(std::memory_order_acquire)) {
+            Chunk &chunk = chunks[t % chunk_count];
+            size_t len = chunk.len.load(std::memory_order_acquire);
+            if (len > chunk.consumed) consumer.consume(chunk.data + chunk.consumed, len - chunk.consumed);
+            chunk.consumed = 0;
+            tail.store(t + 1, std::memory_order_seq_cst);
+            if (producer_waiting.load(std::memory_order_seq_cst)) wake(producer_wake);
+            idle_len = 0;
+            ticks = 0;
+            continue;
+        }
+        uint32_t requested = flush_requested.load(std::memory_order_acquire);
+        if (requested != flush_done.load(std::memory_order_relaxed)) {
+            consumer.flushed();
+            flush_done.store(requested, std::memory_order_seq_cst);
+            if (producer_waiting.load(std::memory_order_seq_cst)) wake(producer_wake);
+            continue;
+        }
+        if (stopping.load(std::memory_order_acquire)) break;
+
+        bool idle = false;
+        {
+            std::unique_lock<std::mutex> guard(sleep_lock);
+            consumer_waiting.store(true, std::memory_order_seq_cst);
+            if (head.load(std::memory_order_seq_cst) == t &&
+                flush_requested.load(std::memory_order_seq_cst) == requested &&
+                !stopping.load(std::memory_order_seq_cst)) {
+                idle = consumer_wakeup.wait_for(guard, std::chrono::milliseconds(idle_ms)) == std::cv_status::timeout;
+            }
+            consumer_waiting.store(false, std::memory_order_relaxed);
+        }
+        if (idle) take_idle(t, idle_len, ticks);
+    }
+}
@@ -0,0 +1,98 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "log_writer.h"
+#include "logcat.h"
+
+using namespace std;
+
+json get_json(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return nullptr;
+    }
+    // Built without exceptions: a parse error gives a discarded value instead of an abort
+    json j = json::parse(file, nullptr, false);
+    return j.is_discarded() ? json(nullptr) : j;
+}
+
+GadgetConfig default_config() {
+    GadgetConfig config{};
+    set_package_name(config, CONFIG_DEFAULT_PACKAGE);
+    config.has_generation = true;
+    return config;
+}
+
+GadgetConfig read_config() {
+    GadgetConfig config;
+    ConfigStatus status = read_gadget_config(config_file_path.c_str(), config);
+    if (!status) {
+        cerr << "[!] " << config_file_path << ": " << config_error_string(status.error);
+        if (status.field != nullptr) cerr << " " << status.field;
+        if (status.error != ConfigError::io) cerr << " at offset " << status.offset;
+        cerr << ", recreating it" << endl;
+        config = default_config();
+    }
+    return config;
+}
+
+bool write_config(const GadgetConfig& config) {
+    // Room for a package name of only escaped characters
+    char data[CONFIG_PACKAGE_MAX * 6 + 256];
+    size_t size = format_gadget_config(config, data, sizeof(data));
+
+    std::string tmp_path = config_file_path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "Unable to write to JSON file: " << tmp_path << endl;
+        return false;
+    }
+    size_t off = 0;
+    while (off < size) {
+        ssize_t n = write(fd, data + off, size - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += n;
+    }
+    bool ok = size > 0 && off == size && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp_path.c_str(), config_file_path.c_str()) != 0) {
+        cerr << "Unable to write to JSON file: " << config_file_path << endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    // Make the rename itself durable
+    std::string module_dir = config_file_path.substr(0, config_file_path.rfind('/'));
+    int dir = open(module_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return true;
+}
+
+ConfigLock::ConfigLock() {
+    std::string lock_path = config_file_path + ".lock";
+    fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd >= 0) flock(fd, LOCK_EX);
+}
+
+ConfigLock::~ConfigLock() {
+    if (fd >= 0) close(fd);
+}
+
+bool update_config(const std::function<void(GadgetConfig&)>& update) {
+    ConfigLock lock;
+    GadgetConfig config = read_config();
+    update(config);
+    config.generation++;
+    config.has_generation = true;
+    return write_config(config);
+}
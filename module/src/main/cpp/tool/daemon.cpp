@@ -0,0 +1,276 @@
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "config.h"
+#include "control.h"
+#include "daemon.h"
+#include "process_matcher.h"
+
+using namespace std;
+
+struct Client {
+    int fd;
+    string input;
+    bool subscriber = false;
+};
+
+static GadgetConfig current;
+static vector<Client> clients;
+
+static string snapshot(const GadgetConfig& config) {
+    char line[CONTROL_LINE_MAX];
+    snprintf(line, sizeof(line), "%llu %s %u %d %d%s%s", (unsigned long long) config.generation,
+             config.package_name, config.delay, config.config_mode, config.profile,
+             config.process_rules[0] != '\0' ? " " : "", config.process_rules);
+    return line;
+}
+
+static bool send_line(int fd, const string& line) {
+    string message = line + "\n";
+    // Never block the daemon on a client that does not read
+    return send(fd, message.data(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t) message.size();
+}
+
+static void close_client(Client& client) {
+    close(client.fd);
+    client.fd = -1;
+}
+
+// Pushes the change to the subscribers first, then persists it for the next boot and for readers
+// without a subscription.
+static void apply(GadgetConfig next) {
+    ConfigLock lock;
+    next.generation = max(current.generation, read_config().generation) + 1;
+    next.has_generation = true;
+    current = next;
+
+    string line = "snapshot " + snapshot(current);
+    for (auto& client : clients) {
+        if (client.fd >= 0 && client.subscriber && !send_line(client.fd, line)) close_client(client);
+    }
+    cout << "[*] " << line << endl;
+
+    write_config(current);
+}
+
+static bool valid_package(const string& package) {
+    if (package.empty() || package.size() >= CONFIG_PACKAGE_MAX) return false;
+    return all_of(package.begin(), package.end(), [](char c) { return c > ' ' && c < 0x7f; });
+}
+
+// The rules from words[first] on, checked by compiling them like the companion will. An empty
+// error means the rules were set.
+static string parse_rules(const vector<string>& words, size_t first, GadgetConfig& config) {
+    string rules;
+    for (size_t i = first; i < words.size(); i++) {
+        if (!valid_package(words[i])) return "error invalid process rule " + words[i];
+        rules += (rules.empty() ? "" : " ") + words[i];
+    }
+    string_view invalid = ProcessMatcher::invalid_rule(rules, config.package_name);
+    if (!invalid.empty()) {
+        return "error invalid process rule " + string(invalid) + ", expected " + config.package_name +
+               ", :<name> or " + config.package_name + ":<name>";
+    }
+    ProcessMatcher matcher;
+    if (!matcher.compile(rules, config.package_name) || !set_process_rules(config, rules)) {
+        return "error too many or too complex process rules";
+    }
+    return "";
+}
+
+static bool parse_uint(const string& value, uint& result) {
+    if (value.empty() || value[0] == '-') return false;
+    char *end;
+    errno = 0;
+    unsigned long parsed = strtoul(value.c_str(), &end, 10);
+    if (*end != '\0' || errno != 0 || parsed > UINT_MAX) return false;
+    result = (uint) parsed;
+    return true;
+}
+
+static bool parse_switch(const string& value, bool& result) {
+    if (value == "on" || value == "1") {
+        result = true;
+    } else if (value == "off" || value == "0") {
+        result = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static string handle_request(Client& client, const string& line) {
+    vector<string> words;
+    size_t pos = 0;
+    while (pos < line.size()) {
+        size_t start = line.find_first_not_of(" \t\r", pos);
+        if (start == string::npos) break;
+        pos = min(line.find_first_of(" \t\r", start), line.size());
+        words.push_back(line.substr(start, pos - start));
+    }
+    if (words.empty()) return "error empty request";
+
+    const string& command = words[0];
+    GadgetConfig next = current;
+    if (command == "show" && words.size() == 1) {
+        return "ok " + snapshot(current);
+    } else if (command == "subscribe" && words.size() == 1) {
+        client.subscriber = true;
+        return "snapshot " + snapshot(current);
+    } else if (command == "target" && words.size() == 2) {
+        if (!valid_package(words[1])) return "error invalid package name";
+        set_package_name(next, words[1]);
+        // Rules like :remote were meant for the previous target
+        set_process_rules(next, "");
+    } else if (command == "delay" && words.size() == 2) {
+        if (!parse_uint(words[1], next.delay)) return "error invalid delay";
+    } else if (command == "config" && words.size() == 2) {
+        if (!parse_switch(words[1], next.config_mode)) return "error expected on or off";
+    } else if (command == "profile" && words.size() == 2) {
+        if (!parse_switch(words[1], next.profile)) return "error expected on or off";
+    } else if (command == "process") {
+        string error = parse_rules(words, 1, next);
+        if (!error.empty()) return error;
+    } else if (command == "set" && words.size() >= 5) {
+        if (!valid_package(words[1])) return "error invalid package name";
+        set_package_name(next, words[1]);
+        if (!parse_uint(words[2], next.delay) || !parse_switch(words[3], next.config_mode) ||
+            !parse_switch(words[4], next.profile)) {
+            return "error invalid value";
+        }
+        string error = parse_rules(words, 5, next);
+        if (!error.empty()) return error;
+    } else {
+        return "error unknown request: " + line;
+    }
+    apply(next);
+    return "ok " + snapshot(current);
+}
+
+static void read_client(Client& client) {
+    char buf[CONTROL_LINE_MAX];
+    ssize_t n = read(client.fd, buf, sizeof(buf));
+    if (n <= 0) {
+        if (n < 0 && errno == EINTR) return;
+        close_client(client);
+        return;
+    }
+    client.input.append(buf, n);
+    size_t end;
+    while (client.fd >= 0 && (end = client.input.find('\n')) != string::npos) {
+        string line = client.input.substr(0, end);
+        client.input.erase(0, end + 1);
+        if (!send_line(client.fd, handle_request(client, line))) close_client(client);
+    }
+    if (client.input.size() > CONTROL_LINE_MAX && client.fd >= 0) close_client(client);
+}
+
+static void accept_client(int server) {
+    int fd = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) return;
+    // Abstract sockets have no file permissions, only root may change the config
+    struct ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != 0) {
+        close(fd);
+        return;
+    }
+    clients.push_back({fd, {}});
+}
+
+int run_daemon() {
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    socklen_t addr_len = control_address(&addr);
+    if (server < 0 || bind(server, reinterpret_cast<struct sockaddr *>(&addr), addr_len) != 0 ||
+        listen(server, 16) != 0) {
+        if (errno == EADDRINUSE) {
+            cerr << "[!] zygisk-gadget daemon is already running" << endl;
+        } else {
+            cerr << "[!] Cannot listen on the control socket: " << strerror(errno) << endl;
+        }
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+
+    {
+        ConfigLock lock;
+        current = read_config();
+    }
+    cout << "[*] Serving " << snapshot(current) << endl;
+
+    vector<pollfd> fds;
+    while (true) {
+        fds.clear();
+        fds.push_back({server, POLLIN, 0});
+        for (const auto& client : clients) fds.push_back({client.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            cerr << "[!] poll: " << strerror(errno) << endl;
+            return -1;
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (fds[i].revents != 0 && clients[i - 1].fd >= 0) read_client(clients[i - 1]);
+        }
+        clients.erase(remove_if(clients.begin(), clients.end(), [](const Client& c) { return c.fd < 0; }),
+                      clients.end());
+        if (fds[0].revents & POLLIN) accept_client(server);
+    }
+}
+
+bool control_request(const string& request, string& reply) {
+    int fd = control_connect();
+    if (fd < 0) return false;
+    string line = request + "\n";
+    send(fd, line.data(), line.size(), MSG_NOSIGNAL);
+
+    reply.clear();
+    char buf[CONTROL_LINE_MAX];
+    while (reply.find('\n') == string::npos) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        reply.append(buf, n);
+    }
+    close(fd);
+    reply = reply.substr(0, reply.find('\n'));
+    if (reply.empty()) reply = "error no reply, the daemon only accepts root";
+    return true;
+}
+
+int run_ctl(int argc, char *argv[]) {
+    if (argc == 0) {
+        printf("Usage: ./zygisk-gadget ctl <request>\n");
+        printf(" Requests:\n");
+        printf("  show                                   Print generation, target, delay, config and profile mode\n");
+        printf("  target <packageName>                   Inject into <packageName> from its next launch on\n");
+        printf("  delay <microseconds>                   Delay before loading frida-gadget\n");
+        printf("  config <on|off>                        Config mode\n");
+        printf("  profile <on|off>                       Profile mode\n");
+        printf("  process [<rule>...]                    Inject into the target's processes matching a rule (<packageName>, :<name>, <packageName>:<name>), by default the main process only\n\n");
+        return -1;
+    }
+    string request = argv[0];
+    for (int i = 1; i < argc; i++) request += string(" ") + argv[i];
+
+    string reply;
+    if (!control_request(request, reply)) {
+        cerr << "[!] zygisk-gadget daemon is not running" << endl;
+        return -1;
+    }
+    cout << reply << endl;
+    return reply.starts_with("ok") ? 0 : -1;
+}
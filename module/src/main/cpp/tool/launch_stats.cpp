@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+#include "launch_stats.h"
+
+static uint64_t to_us(uint32_t sec, uint32_t nsec) {
+    return (uint64_t) sec * 1000000 + nsec / 1000;
+}
+
+void LaunchStats::on_app_start() {
+    failed += pending.size();  // restarted before the gadget reported anything
+    pending.clear();
+}
+
+void LaunchStats::on_process_start(pid_t pid, uint32_t sec, uint32_t nsec) {
+    for (auto &launch : pending) {
+        if (launch.pid != pid) continue;
+        failed++;
+        launch.start_us = to_us(sec, nsec);
+        return;
+    }
+    pending.push_back({pid, to_us(sec, nsec)});
+}
+
+void LaunchStats::on_gadget_result(pid_t pid, uint32_t sec, uint32_t nsec, bool loaded) {
+    auto launch = std::find_if(pending.begin(), pending.end(), [&](const Pending &p) { return p.pid == pid; });
+    if (launch == pending.end()) return;
+    uint64_t start_us = launch->start_us;
+    pending.erase(launch);
+    uint64_t now_us = to_us(sec, nsec);
+    if (!loaded) {
+        failed++;
+        return;
+    }
+    latencies_us.push_back(now_us > start_us ? now_us - start_us : 0);
+}
+
+static void append_format(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append_format(std::string &out, const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len > 0) out.append(buf, std::min<size_t>(len, sizeof(buf) - 1));
+}
+
+std::string LaunchStats::report() const {
+    std::string out;
+    append_format(out, "%zu launches, %zu loaded, %zu failed (%.1f%%)\n", completed(), latencies_us.size(),
+                  failed, completed() == 0 ? 0.0 : 100.0 * (double) failed / (double) completed());
+    if (latencies_us.empty()) return out;
+
+    std::vector<uint64_t> sorted = latencies_us;
+    std::sort(sorted.begin(), sorted.end());
+    // nearest-rank percentile
+    auto percentile = [&](double p) {
+        size_t rank = (size_t) (p / 100.0 * (double) sorted.size() + 0.999999);
+        return (double) sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1] / 1000.0;
+    };
+    append_format(out, "start -> gadget loaded (ms): min %.1f, p50 %.1f, p95 %.1f, p99 %.1f, max %.1f\n",
+                  (double) sorted.front() / 1000.0, percentile(50), percentile(95), percentile(99),
+                  (double) sorted.back() / 1000.0);
+
+    // [2^i, 2^(i+1)) ms buckets, the first one also holds everything below 1 ms
+    size_t buckets[32]{};
+    size_t last = 0;
+    for (uint64_t us : sorted) {
+        uint64_t ms = us / 1000;
+        size_t bucket = 0;
+        while (bucket < 31 && ms >= (2ULL << bucket)) bucket++;
+        buckets[bucket]++;
+        last = std::max(last, bucket);
+    }
+    size_t first = 0;
+    while (buckets[first] == 0) first++;
+    size_t peak = *std::max_element(buckets, buckets + 32);
+    for (size_t i = first; i <= last; i++) {
+        append_format(out, "  %6llu - %6llu ms %5zu |%.*s\n", i == 0 ? 0ULL : 1ULL << i, 2ULL << i, buckets[i],
+                      (int) (buckets[i] * 40 / peak), "########################################");
+    }
+    return out;
+}
@@ -0,0 +1,257 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "log_capture.h"
+
+#define LZ4_FRAME_MAGIC 0x184d2204
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000u
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5  // the last bytes of a block are always literals
+#define LZ4_MATCH_LIMIT 12   // the last match starts at least this far from the end
+#define LZ4_HASH_BITS 12
+#define LZ4_BOUND(size) ((size) + (size) / 255 + 16)
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint8_t *put32(uint8_t *p, uint32_t value) {
+    memcpy(p, &value, sizeof(value));
+    return p + sizeof(value);
+}
+
+static inline uint32_t rotl32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// XXH32, used by the LZ4 frame format for the header and block checksums
+static uint32_t xxh32(const uint8_t *p, size_t len, uint32_t seed) {
+    constexpr uint32_t prime1 = 2654435761u, prime2 = 2246822519u, prime3 = 3266489917u;
+    constexpr uint32_t prime4 = 668265263u, prime5 = 374761393u;
+    const uint8_t *end = p + len;
+    uint32_t hash;
+    if (len >= 16) {
+        uint32_t v[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        for (; end - p >= 16; p += 16) {
+            for (int i = 0; i < 4; i++) v[i] = rotl32(v[i] + load32(p + 4 * i) * prime2, 13) * prime1;
+        }
+        hash = rotl32(v[0], 1) + rotl32(v[1], 7) + rotl32(v[2], 12) + rotl32(v[3], 18);
+    } else {
+        hash = seed + prime5;
+    }
+    hash += (uint32_t) len;
+    for (; end - p >= 4; p += 4) hash = rotl32(hash + load32(p) * prime3, 17) * prime4;
+    for (; p < end; p++) hash = rotl32(hash + *p * prime5, 11) * prime1;
+    hash ^= hash >> 15;
+    hash *= prime2;
+    hash ^= hash >> 13;
+    hash *= prime3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static uint8_t *put_length(uint8_t *p, size_t len) {
+    for (; len >= 255; len -= 255) *p++ = 255;
+    *p++ = (uint8_t) len;
+    return p;
+}
+
+static uint8_t *put_sequence(uint8_t *p, const uint8_t *literals, size_t literal_len, uint16_t offset, size_t match_len) {
+    uint8_t *token = p++;
+    *token = (uint8_t) (std::min<size_t>(literal_len, 15) << 4);
+    if (literal_len >= 15) p = put_length(p, literal_len - 15);
+    memcpy(p, literals, literal_len);
+    p += literal_len;
+    if (match_len == 0) return p;  // the last sequence has no match
+    p[0] = (uint8_t) offset;
+    p[1] = (uint8_t) (offset >> 8);
+    p += 2;
+    match_len -= LZ4_MIN_MATCH;
+    *token |= (uint8_t) std::min<size_t>(match_len, 15);
+    if (match_len >= 15) p = put_length(p, match_len - 15);
+    return p;
+}
+
+// Greedy LZ4 block compression of at most 64 KiB, dst holds LZ4_BOUND(size) bytes. Log records
+// repeat their header layout, tags and message prefixes, which a single hash probe finds well
+// enough; compressing a block takes a fraction of the time logd needs to deliver it.
+static size_t lz4_compress(const uint8_t *src, size_t size, uint8_t *dst) {
+    uint16_t table[1 << LZ4_HASH_BITS]{};
+    uint8_t *p = dst;
+    size_t anchor = 0;
+    if (size > LZ4_MATCH_LIMIT) {
+        size_t pos = 0, limit = size - LZ4_MATCH_LIMIT;
+        while (pos < limit) {
+            uint32_t sequence = load32(src + pos);
+            uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            size_t ref = table[hash];
+            table[hash] = (uint16_t) pos;
+            if (ref >= pos || load32(src + ref) != sequence) {
+                // Skip faster through data that does not compress
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+            while (pos > anchor && ref > 0 && src[pos - 1] == src[ref - 1]) pos--, ref--;
+            size_t len = LZ4_MIN_MATCH;
+            while (pos + len < size - LZ4_LAST_LITERALS && src[pos + len] == src[ref + len]) len++;
+            p = put_sequence(p, src + anchor, pos - anchor, (uint16_t) (pos - ref), len);
+            pos += len;
+            anchor = pos;
+        }
+    }
+    p = put_sequence(p, src + anchor, size - anchor, 0, 0);
+    return p - dst;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+    auto p = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+std::unique_ptr<LogCapture> LogCapture::open(const char *dir) {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return nullptr;
+    DIR *d = opendir(dir);
+    if (d == nullptr) return nullptr;
+    std::vector<uint> segments;
+    while (auto entry = readdir(d)) {
+        uint number;
+        int end = 0;
+        if (sscanf(entry->d_name, "%u.zglog.lz4%n", &number, &end) == 1 && entry->d_name[end] == '\0') {
+            segments.push_back(number);
+        }
+    }
+    closedir(d);
+    std::sort(segments.begin(), segments.end());
+    return std::unique_ptr<LogCapture>(new LogCapture(dir, std::move(segments)));
+}
+
+LogCapture::LogCapture(std::string dir, std::vector<uint> segments) :
+        dir(std::move(dir)), segments(std::move(segments)),
+        compressed(new uint8_t[LZ4_BOUND(LOG_CAPTURE_BLOCK_SIZE)]),
+        batch(new uint8_t[LOG_CAPTURE_WRITE_BATCH + LZ4_BOUND(LOG_CAPTURE_BLOCK_SIZE) + 64]),
+        queue(*this, LOG_CAPTURE_BLOCK_SIZE, LOG_CAPTURE_BLOCKS, LOG_CAPTURE_IDLE_MS, LOG_CAPTURE_MAX_IDLE_TICKS) {}
+
+LogCapture::~LogCapture() {
+    close();
+}
+
+void LogCapture::add(const log_msg *msg) {
+    size_t size = msg->entry.hdr_size + msg->entry.len;
+    memcpy(queue.reserve(size), msg->buf, size);
+    queue.commit(size);
+}
+
+void LogCapture::close() {
+    queue.flush();
+}
+
+void LogCapture::flushed() {
+    if (segment_fd >= 0) close_segment();
+}
+
+void LogCapture::fail(const char *what) {
+    if (!failed) fprintf(stderr, "[!] Capture: %s failed in %s: %s\n", what, dir.c_str(), strerror(errno));
+    failed = true;
+}
+
+bool LogCapture::open_segment() {
+    while (segments.size() >= LOG_CAPTURE_MAX_SEGMENTS) {
+        char path[64];
+        snprintf(path, sizeof(path), "/%u.zglog.lz4", segments.front());
+        unlink((dir + path).c_str());
+        snprintf(path, sizeof(path), "/%u.idx", segments.front());
+        unlink((dir + path).c_str());
+        segments.erase(segments.begin());
+    }
+    uint number = segments.empty() ? 1 : segments.back() + 1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/%u.zglog.lz4", number);
+    segment_fd = ::open((dir + path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    snprintf(path, sizeof(path), "/%u.idx", number);
+    index_fd = ::open((dir + path).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (segment_fd < 0 || index_fd < 0) {
+        fail("open");
+        if (segment_fd >= 0) ::close(segment_fd);
+        if (index_fd >= 0) ::close(index_fd);
+        segment_fd = index_fd = -1;
+        return false;
+    }
+    segments.push_back(number);
+    if (!write_all(index_fd, LOG_CAPTURE_INDEX_MAGIC, LOG_CAPTURE_INDEX_MAGIC_LEN)) fail("write");
+
+    // Frame descriptor: version 01, independent blocks, block checksums; 64 KiB maximum block size
+    uint8_t *p = put32(batch.get(), LZ4_FRAME_MAGIC);
+    p[0] = 0x70;
+    p[1] = 0x40;
+    p[2] = (uint8_t) (xxh32(p, 2, 0) >> 8);
+    p += 3;
+    // The magic block makes the segment decompress to a capture file of its own
+    auto magic = reinterpret_cast<const uint8_t *>(LOG_CAPTURE_MAGIC);
+    p = put32(p, LOG_CAPTURE_MAGIC_LEN | LZ4_BLOCK_UNCOMPRESSED);
+    memcpy(p, magic, LOG_CAPTURE_MAGIC_LEN);
+    p = put32(p + LOG_CAPTURE_MAGIC_LEN, xxh32(magic, LOG_CAPTURE_MAGIC_LEN, 0));
+    batch_len = segment_size = p - batch.get();
+    return true;
+}
+
+void LogCapture::write_batch() {
+    if (!write_all(segment_fd, batch.get(), batch_len) ||
+        !write_all(index_fd, index_batch, index_len * sizeof(LogCaptureIndexEntry))) {
+        fail("write");
+    }
+    batch_len = 0;
+    index_len = 0;
+}
+
+void LogCapture::close_segment() {
+    put32(batch.get() + batch_len, 0);  // end mark
+    batch_len += 4;
+    write_batch();
+    if (fdatasync(segment_fd) != 0 || fdatasync(index_fd) != 0) fail("fdatasync");
+    ::close(segment_fd);
+    ::close(index_fd);
+    segment_fd = index_fd = -1;
+}
+
+void LogCapture::consume(const uint8_t *data, size_t size) {
+    if (segment_fd < 0 && !open_segment()) return;
+
+    logger_entry first;
+    memcpy(&first, data, sizeof(first));
+    index_batch[index_len++] = {first.sec, first.nsec, segment_size};
+    size_t compressed_size = lz4_compress(data, size, compressed.get());
+    const uint8_t *stored = compressed.get();
+    uint32_t header = (uint32_t) compressed_size;
+    if (compressed_size >= size) {
+        stored = data;
+        compressed_size = size;
+        header = (uint32_t) size | LZ4_BLOCK_UNCOMPRESSED;
+    }
+    uint8_t *p = put32(batch.get() + batch_len, header);
+    memcpy(p, stored, compressed_size);
+    put32(p + compressed_size, xxh32(stored, compressed_size, 0));
+    batch_len += compressed_size + 8;
+    segment_size += compressed_size + 8;
+
+    if (segment_size >= LOG_CAPTURE_SEGMENT_SIZE) {
+        close_segment();
+    } else if (batch_len >= LOG_CAPTURE_WRITE_BATCH || index_len == std::size(index_batch)) {
+        write_batch();
+    }
+}
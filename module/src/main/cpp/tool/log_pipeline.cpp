@@ -0,0 +1,118 @@
+#include <signal.h>
+
+#include "log_pipeline.h"
+
+#define LOG_PIPELINE_SPINS 64  // yielding polls before going to sleep, a futex round trip costs far more
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<bool>::is_always_lock_free,
+              "interrupt() runs in a signal handler");
+
+LogPipeline::LogPipeline(LogSource &source, bool lossy) :
+        source(source), lossy(lossy), slots(new log_msg[LOG_PIPELINE_SLOTS]) {
+    // Signals are handled by the decoding thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    reader = std::thread(&LogPipeline::reader_loop, this);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+}
+
+LogPipeline::~LogPipeline() {
+    stop();
+    reader.join();
+    delete[] slots;
+}
+
+static void wake(std::atomic<uint32_t> &counter) {
+    counter.fetch_add(1, std::memory_order_seq_cst);
+    counter.notify_one();
+}
+
+void LogPipeline::stop() {
+    stopping.store(true, std::memory_order_seq_cst);
+    wake(reader_wake);
+}
+
+// The decoder waits on decoder_wake, so changing it ends the wait: the futex call returns EINTR
+// when the handler interrupted it, or does not sleep when the handler ran just before it
+void LogPipeline::interrupt() {
+    interrupted.store(true, std::memory_order_seq_cst);
+    decoder_wake.fetch_add(1, std::memory_order_seq_cst);
+}
+
+void LogPipeline::reader_loop() {
+    int len = 0;
+    uint32_t spins = 0;
+    while (!stopping.load(std::memory_order_seq_cst)) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        log_msg *msg;
+        if (h - t < LOG_PIPELINE_SLOTS) {
+            msg = &slots[h & (LOG_PIPELINE_SLOTS - 1)];
+        } else if (lossy) {
+            msg = &scratch;
+        } else {
+            if (spins++ < LOG_PIPELINE_SPINS) {
+                std::this_thread::yield();
+                continue;
+            }
+            spins = 0;
+            uint32_t wake_seq = reader_wake.load(std::memory_order_seq_cst);
+            reader_waiting.store(true, std::memory_order_seq_cst);
+            if (tail.load(std::memory_order_seq_cst) == t && !stopping.load(std::memory_order_seq_cst)) {
+                reader_wake.wait(wake_seq);
+            }
+            reader_waiting.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        len = source.read(msg);
+        if (len <= 0) break;
+        if (msg == &scratch) {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        head.store(h + 1, std::memory_order_seq_cst);
+        if (decoder_waiting.load(std::memory_order_seq_cst)) wake(decoder_wake);
+    }
+
+    status.store(len < 0 ? len : 0, std::memory_order_seq_cst);
+    wake(decoder_wake);
+}
+
+log_msg *LogPipeline::next() {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t spins = 0;
+    if (holding) {
+        tail.store(++t, std::memory_order_seq_cst);
+        holding = false;
+        // Let the reader refill in batches rather than waking it for every slot
+        if (reader_waiting.load(std::memory_order_seq_cst) &&
+            head.load(std::memory_order_relaxed) - t <= LOG_PIPELINE_SLOTS / 2) {
+            wake(reader_wake);
+        }
+    }
+
+    while (true) {
+        if (interrupted.load(std::memory_order_seq_cst)) return nullptr;
+        uint32_t h = head.load(std::memory_order_acquire);
+        if (h != t) {
+            holding = true;
+            return &slots[t & (LOG_PIPELINE_SLOTS - 1)];
+        }
+        if (status.load(std::memory_order_acquire) <= 0) return nullptr;
+        if (spins++ < LOG_PIPELINE_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+        spins = 0;
+
+        uint32_t wake_seq = decoder_wake.load(std::memory_order_seq_cst);
+        decoder_waiting.store(true, std::memory_order_seq_cst);
+        if (head.load(std::memory_order_seq_cst) == h && status.load(std::memory_order_seq_cst) > 0 &&
+            !interrupted.load(std::memory_order_seq_cst)) {
+            decoder_wake.wait(wake_seq);
+        }
+        decoder_waiting.store(false, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,139 @@
+#include <unistd.h>
+#include <android/log.h>
+#include <algorithm>
+#include <cstring>
+
+#include "log_source.h"
+
+#define LOG_CAPTURE_BUFFER_SIZE (1024 * 1024)
+
+extern "C" {
+
+struct log_time {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+};
+
+[[gnu::weak]] struct logger_list *android_logger_list_alloc(int mode, unsigned int tail, pid_t pid);
+[[gnu::weak]] struct logger_list *android_logger_list_alloc_time(int mode, log_time start, pid_t pid);
+[[gnu::weak]] void android_logger_list_free(struct logger_list *list);
+[[gnu::weak]] int android_logger_list_read(struct logger_list *list, struct log_msg *log_msg);
+[[gnu::weak]] struct logger *android_logger_open(struct logger_list *list, log_id_t id);
+
+}
+
+LogdSource::~LogdSource() {
+    if (list != nullptr) android_logger_list_free(list);
+}
+
+bool LogdSource::connect() {
+    if (last_count > 0 && android_logger_list_alloc_time != nullptr) {
+        // Records at or after the last timestamp, so nothing written while disconnected is lost
+        list = android_logger_list_alloc_time(0, {last_sec, last_nsec}, 0);
+        resuming = true;
+    } else {
+        list = android_logger_list_alloc(0, 1, 0);
+    }
+    if (list == nullptr) return false;
+    for (log_id id: {LOG_ID_MAIN, LOG_ID_EVENTS}) {
+        android_logger_open(list, id);
+    }
+    return true;
+}
+
+bool LogdSource::seen(const logger_entry &entry) const {
+    if (entry.sec != last_sec || entry.nsec != last_nsec) {
+        return entry.sec < last_sec || (entry.sec == last_sec && entry.nsec < last_nsec);
+    }
+    for (uint i = 0; i < last_count; i++) {
+        if (last_keys[i].pid == entry.pid && last_keys[i].tid == entry.tid) return true;
+    }
+    return false;
+}
+
+void LogdSource::remember(const logger_entry &entry) {
+    if (entry.sec != last_sec || entry.nsec != last_nsec) {
+        last_sec = entry.sec;
+        last_nsec = entry.nsec;
+        last_count = 0;
+    }
+    if (last_count < LOGD_SOURCE_MAX_SEEN) last_keys[last_count++] = {entry.pid, entry.tid};
+}
+
+int LogdSource::read(log_msg *msg) {
+    if (android_logger_list_alloc == nullptr) return -1;
+    while (true) {
+        if (list == nullptr && !connect()) {
+            backoff_us = std::clamp(backoff_us * 2, (uint) LOGD_SOURCE_BACKOFF_MIN_US, (uint) LOGD_SOURCE_BACKOFF_MAX_US);
+            usleep(backoff_us);
+            continue;
+        }
+
+        int len = android_logger_list_read(list, msg);
+        if (len > 0) {
+            backoff_us = 0;
+            if (resuming) {
+                // logd resends from the last timestamp, until the first record after it
+                if (seen(msg->entry)) continue;
+                resuming = msg->entry.sec == last_sec && msg->entry.nsec == last_nsec;
+            }
+            remember(msg->entry);
+            return len;
+        }
+
+        android_logger_list_free(list);
+        list = nullptr;
+        backoff_us = std::clamp(backoff_us * 2, (uint) LOGD_SOURCE_BACKOFF_MIN_US, (uint) LOGD_SOURCE_BACKOFF_MAX_US);
+        usleep(backoff_us);
+    }
+}
+
+std::unique_ptr<FileSource> FileSource::open(const char *path) {
+    FILE *file = fopen(path, "rbe");
+    if (file == nullptr) return nullptr;
+
+    char magic[LOG_CAPTURE_MAGIC_LEN];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, LOG_CAPTURE_MAGIC, sizeof(magic)) != 0) {
+        fclose(file);
+        return nullptr;
+    }
+    setvbuf(file, nullptr, _IOFBF, LOG_CAPTURE_BUFFER_SIZE);
+    return std::unique_ptr<FileSource>(new FileSource(file));
+}
+
+FileSource::~FileSource() {
+    fclose(file);
+}
+
+int FileSource::read(log_msg *msg) {
+    // len and hdr_size lead every record, the rest of the header follows
+    if (fread(msg->buf, 1, 4, file) != 4) return 0;
+    size_t hdr_size = msg->entry.hdr_size, len = msg->entry.len;
+    if (hdr_size != sizeof(logger_entry) || hdr_size + len > LOGGER_ENTRY_MAX_LEN) return -1;
+    if (fread(msg->buf + 4, 1, hdr_size + len - 4, file) != hdr_size + len - 4) return -1;
+    msg->buf[hdr_size + len] = '\0';
+    bytes += hdr_size + len;
+    return (int) (hdr_size + len);
+}
+
+std::unique_ptr<RecordingSource> RecordingSource::open(const char *path, std::unique_ptr<LogSource> source) {
+    FILE *file = fopen(path, "wbe");
+    if (file == nullptr) return nullptr;
+    setvbuf(file, nullptr, _IOFBF, LOG_CAPTURE_BUFFER_SIZE);
+    fwrite(LOG_CAPTURE_MAGIC, 1, LOG_CAPTURE_MAGIC_LEN, file);
+    return std::unique_ptr<RecordingSource>(new RecordingSource(file, std::move(source)));
+}
+
+RecordingSource::~RecordingSource() {
+    fclose(file);
+}
+
+int RecordingSource::read(log_msg *msg) {
+    int len = source->read(msg);
+    if (len > 0) fwrite(msg->buf, 1, msg->entry.hdr_size + msg->entry.len, file);
+    return len;
+}
+
+void RecordingSource::flush() {
+    fflush(file);
+}
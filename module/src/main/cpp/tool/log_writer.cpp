@@ -0,0 +1,267 @@
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "log_writer.h"
+
+LogWriter::LogWriter(int fd) :
+        fd(fd), queue(*this, LOG_WRITER_CHUNK_SIZE, LOG_WRITER_CHUNKS, LOG_WRITER_IDLE_MS, LOG_WRITER_MAX_IDLE_TICKS) {}
+
+LogWriter::~LogWriter() {
+    queue.flush();
+}
+
+// write() reserved room for the whole line
+void LogWriter::append(std::string_view str) {
+    memcpy(out, str.data(), str.size());
+    out += str.size();
+}
+
+static inline void put_2digits(char *p, int value) {
+    p[0] = (char) ('0' + value / 10);
+    p[1] = (char) ('0' + value % 10);
+}
+
+struct MillisTable {
+    char digits[1000][3];
+};
+
+static constexpr MillisTable millis_table = [] {
+    MillisTable table{};
+    for (int i = 0; i < 1000; i++) {
+        table.digits[i][0] = (char) ('0' + i / 100);
+        table.digits[i][1] = (char) ('0' + i / 10 % 10);
+        table.digits[i][2] = (char) ('0' + i % 10);
+    }
+    return table;
+}();
+
+// localtime_r() is only called once per hour of log time, which also picks up DST changes.
+void LogWriter::refresh_tz_offset(time_t sec) {
+    struct tm local_time{};
+    localtime_r(&sec, &local_time);
+    tz_offset = local_time.tm_gmtoff;
+    tz_from = sec - local_time.tm_min * 60 - local_time.tm_sec;
+    tz_until = tz_from + 3600;
+}
+
+void LogWriter::append_timestamp(time_t sec, long nsec) {
+    if (sec != cached_sec) {
+        if (sec < tz_from || sec >= tz_until) refresh_tz_offset(sec);
+        long day_sec = (long) ((sec + tz_offset) % 86400);
+        if (day_sec < 0) day_sec += 86400;
+        put_2digits(cached_hms, (int) (day_sec / 3600));
+        cached_hms[2] = ':';
+        put_2digits(cached_hms + 3, (int) (day_sec / 60 % 60));
+        cached_hms[5] = ':';
+        put_2digits(cached_hms + 6, (int) (day_sec % 60));
+        cached_sec = sec;
+    }
+
+    char stamp[12];
+    memcpy(stamp, cached_hms, sizeof(cached_hms));
+    stamp[8] = '.';
+    long ms = nsec / 1000000;
+    memcpy(stamp + 9, millis_table.digits[ms < 0 || ms > 999 ? 0 : ms], 3);
+    append(std::string_view(stamp, sizeof(stamp)));
+}
+
+void LogWriter::append_text(const LogLine &line) {
+    append_timestamp(line.sec, line.nsec);
+    append(" ");
+    append(line.tag);
+    append(" ");
+    append(line.message);
+    append("\n");
+}
+
+static char *put_uint(char *p, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) *p++ = digits[--n];
+    return p;
+}
+
+static char *put_int(char *p, int64_t value) {
+    if (value < 0) {
+        *p++ = '-';
+        return put_uint(p, (uint64_t) -value);
+    }
+    return put_uint(p, (uint64_t) value);
+}
+
+// Length of the valid UTF-8 sequence at p, 0 if there is none
+static size_t utf8_sequence(const unsigned char *p, const unsigned char *end) {
+    size_t len;
+    uint32_t min;
+    if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+        len = 2, min = 0x80;
+    } else if ((p[0] & 0xf0) == 0xe0) {
+        len = 3, min = 0x800;
+    } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+        len = 4, min = 0x10000;
+    } else {
+        return 0;
+    }
+    if ((size_t) (end - p) < len) return 0;
+    uint32_t code = p[0] & (0x7f >> len);
+    for (size_t i = 1; i < len; i++) {
+        if ((p[i] & 0xc0) != 0x80) return 0;
+        code = (code << 6) | (p[i] & 0x3f);
+    }
+    if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) return 0;
+    return len;
+}
+
+// Writes a JSON string (with quotes). Invalid UTF-8 becomes U+FFFD, so the output always parses.
+// The caller reserved 6 bytes per input byte plus the quotes.
+void LogWriter::append_json_string(std::string_view str) {
+    static const char hex[] = "0123456789abcdef";
+    auto p = reinterpret_cast<const unsigned char *>(str.data());
+    auto end = p + str.size();
+
+    *out++ = '"';
+    while (p < end) {
+        // Plain ASCII runs are copied as they are
+        auto run = p;
+        while (p < end && *p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\') p++;
+        memcpy(out, run, p - run);
+        out += p - run;
+        if (p == end) break;
+
+        unsigned char c = *p;
+        if (c >= 0x80) {
+            size_t len = utf8_sequence(p, end);
+            if (len == 0) {
+                memcpy(out, "\\ufffd", 6);
+                out += 6;
+                p++;
+            } else {
+                memcpy(out, p, len);
+                out += len;
+                p += len;
+            }
+            continue;
+        }
+
+        *out++ = '\\';
+        switch (c) {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '\n': *out++ = 'n'; break;
+            case '\r': *out++ = 'r'; break;
+            case '\t': *out++ = 't'; break;
+            case '\b': *out++ = 'b'; break;
+            case '\f': *out++ = 'f'; break;
+            default:
+                memcpy(out, "u00", 3);
+                out[3] = hex[c >> 4];
+                out[4] = hex[c & 0xf];
+                out += 5;
+                break;
+        }
+        p++;
+    }
+    *out++ = '"';
+}
+
+void LogWriter::append_json(const LogLine &line) {
+    char buf[160];
+    char *p = buf;
+    memcpy(p, "{\"ts\":", 6);
+    p = put_uint(p + 6, line.sec);
+    *p++ = '.';
+    char nsec[9];
+    uint32_t value = line.nsec;
+    for (int i = 8; i >= 0; i--, value /= 10) nsec[i] = (char) ('0' + value % 10);
+    memcpy(p, nsec, 9);
+    p += 9;
+    memcpy(p, ",\"pid\":", 7);
+    p = put_int(p + 7, line.pid);
+    memcpy(p, ",\"tid\":", 7);
+    p = put_int(p + 7, line.tid);
+    memcpy(p, ",\"prio\":", 8);
+    p = put_uint(p + 8, line.prio);
+    memcpy(p, ",\"tag\":", 7);
+    append(std::string_view(buf, p + 7 - buf));
+    append_json_string(line.tag);
+    append(",\"msg\":");
+    append_json_string(line.message);
+    append("}\n");
+}
+
+void LogWriter::append_bin(const LogLine &line) {
+    LogBinRecord record{};
+    size_t tag_len = std::min<size_t>(line.tag.size(), UINT16_MAX);
+    size_t size = sizeof(LogBinRecord) + tag_len + line.message.size();
+    record.size = (uint32_t) ((size + 7) & ~(size_t) 7);
+    record.sec = line.sec;
+    record.nsec = line.nsec;
+    record.pid = line.pid;
+    record.tid = line.tid;
+    record.prio = line.prio;
+    record.tag_len = (uint16_t) tag_len;
+    record.msg_len = (uint32_t) line.message.size();
+
+    static const char padding[8]{};
+    append(std::string_view(reinterpret_cast<const char *>(&record), sizeof(record)));
+    append(line.tag.substr(0, tag_len));
+    append(line.message);
+    append(std::string_view(padding, record.size - size));
+}
+
+void LogWriter::set_format(LogFormat new_format) {
+    format = new_format;
+    if (format != LogFormat::bin) return;
+    char *start = out = (char *) queue.reserve(LOG_BIN_MAGIC_LEN);
+    append(std::string_view(LOG_BIN_MAGIC, LOG_BIN_MAGIC_LEN));
+    queue.commit(out - start);
+}
+
+void LogWriter::write(const LogLine &line) {
+    // A log line is at most LOGGER_ENTRY_MAX_LEN, so it always fits an empty chunk, even with
+    // every byte escaped as \u00XX
+    size_t worst = 128 + 6 * (line.tag.size() + line.message.size());
+    char *start = out = (char *) queue.reserve(worst);
+
+    switch (format) {
+        case LogFormat::text:
+            append_text(line);
+            break;
+        case LogFormat::jsonl:
+            append_json(line);
+            break;
+        case LogFormat::bin:
+            append_bin(line);
+            break;
+    }
+    queue.commit(out - start);
+}
+
+void LogWriter::write_line(uint32_t sec, uint32_t nsec, std::string_view tag, std::string_view message) {
+    write({sec, nsec, 0, 0, 4 /* ANDROID_LOG_INFO */, tag, message});
+}
+
+void LogWriter::flush() {
+    queue.flush();
+}
+
+void LogWriter::consume(const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;  // the reader went away, drop the rest
+        data += n;
+        size -= n;
+    }
+}
+
+LogWriter &stdout_writer() {
+    static auto writer = new LogWriter(STDOUT_FILENO);
+    return *writer;
+}
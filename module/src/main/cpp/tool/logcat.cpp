@@ -1,42 +1,25 @@
 // https://github.com/topjohnwu/Magisk/blob/master/native/src/core/deny/logcat.cpp
 #include <unistd.h>
 #include <android/log.h>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <chrono>
+#include <cstring>
 #include <iostream>
-#include <iomanip>
+#include <string>
+#include <vector>
 
-using namespace std;
-
-struct logger_entry {
-    uint16_t len;      /* length of the payload */
-    uint16_t hdr_size; /* sizeof(struct logger_entry) */
-    int32_t pid;       /* generating process's pid */
-    uint32_t tid;      /* generating process's tid */
-    uint32_t sec;      /* seconds since Epoch */
-    uint32_t nsec;     /* nanoseconds */
-    uint32_t lid;      /* log id of the payload, bottom 4 bits currently */
-    uint32_t uid;      /* generating process's uid */
-};
+#include "launch_stats.h"
+#include "log_capture.h"
+#include "log_pipeline.h"
+#include "log_source.h"
+#include "log_writer.h"
+#include "logcat.h"
+#include "matcher.h"
+#include "process_matcher.h"
 
-#define LOGGER_ENTRY_MAX_LEN (5 * 1024)
-struct log_msg {
-    union [[gnu::aligned(4)]] {
-        unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1];
-        struct logger_entry entry;
-    };
-};
-
-struct AndroidLogEntry {
-    time_t tv_sec;
-    long tv_nsec;
-    android_LogPriority priority;
-    int32_t uid;
-    int32_t pid;
-    int32_t tid;
-    const char *tag;
-    size_t tagLen;
-    size_t messageLen;
-    const char *message;
-};
+using namespace std;
 
 struct [[gnu::packed]] android_event_header_t {
     int32_t tag;    // Little Endian Order
@@ -72,28 +55,113 @@ struct [[gnu::packed]] android_event_am_proc_start {
 
 // 3040 boot_progress_ams_ready (time|2|3)
 
-extern "C" {
+#define EVENT_TYPE_INT 0
+#define EVENT_TYPE_STRING 2
+#define EVENT_TYPE_LIST 3
+
+#define MAX_TARGET_PROCESSES 16
+
+static string target_package;
+// The running processes of the target package (the main process and its "pkg:name" processes)
+static pid_t target_pids[MAX_TARGET_PROCESSES];
+static size_t target_process_count = 0;
+
+static vector<pid_t> profiled_pids;
+
+// --measure: number of launches to collect, 0 when not measuring
+static uint measure_launches = 0;
+static LaunchStats launch_stats;
+// The processes the companion injects into, so each of their starts is a launch
+static ProcessMatcher injected_matcher;
+
+static RecordingSource *recording = nullptr;
+// --capture: the entries the follower keeps, so a segment replays to the same output
+static LogCapture *capture = nullptr;
+
+// Set from the SIGINT handler, which runs on the decoding thread: the other threads block signals
+static std::atomic<bool> interrupted{false};
+static std::atomic<LogPipeline *> following{nullptr};
+static_assert(std::atomic<LogPipeline *>::is_always_lock_free);
+
+// The pipeline the decoder reads from, which logcat_interrupt() wakes
+static void follow(LogPipeline *pipeline) {
+    following.store(pipeline, std::memory_order_seq_cst);
+    if (pipeline != nullptr && interrupted.load(std::memory_order_seq_cst)) pipeline->interrupt();
+}
+
+// Lines of other processes are printed when their tag or message matches
+static MultiMatcher tag_matcher;
+static MultiMatcher message_matcher;
 
-[[gnu::weak]] struct logger_list *android_logger_list_alloc(int mode, unsigned int tail, pid_t pid);
-[[gnu::weak]] void android_logger_list_free(struct logger_list *list);
-[[gnu::weak]] int android_logger_list_read(struct logger_list *list, struct log_msg *log_msg);
-[[gnu::weak]] struct logger *android_logger_open(struct logger_list *list, log_id_t id);
-[[gnu::weak]] int android_log_processLogBuffer(struct logger_entry *buf, AndroidLogEntry *entry);
+static bool is_target_pid(pid_t pid) {
+    for (size_t i = 0; i < target_process_count; i++) {
+        if (target_pids[i] == pid) return true;
+    }
+    return false;
+}
 
+static bool is_target_process(string_view proc) {
+    if (target_package.empty() || !proc.starts_with(target_package)) return false;
+    return proc.size() == target_package.size() || proc[target_package.size()] == ':';
 }
 
 static void process_main_buffer(struct log_msg *msg) {
-    AndroidLogEntry entry{};
-    if (android_log_processLogBuffer(&msg->entry, &entry) < 0) return;
-    entry.tagLen--;
-    auto tag = string_view(entry.tag, entry.tagLen);
+    // Payload of a main buffer entry: prio, tag\0, message\0
+    size_t len = msg->entry.len;
+    if (len < 2) return;
+    auto payload = reinterpret_cast<const char *>(&msg->buf[msg->entry.hdr_size]);
+    auto tag = string_view(payload + 1, strnlen(payload + 1, len - 1));
+    size_t message_start = min(1 + tag.size() + 1, len);
+    size_t message_len = len - message_start;
+    while (message_len > 0 && payload[message_start + message_len - 1] == '\0') message_len--;
+    auto message = string_view(payload + message_start, message_len);
+
+    if (!is_target_pid(msg->entry.pid) && !tag_matcher.contains_any(tag) && !message_matcher.contains_any(message)) {
+        return;
+    }
+    stdout_writer().write({msg->entry.sec, msg->entry.nsec, msg->entry.pid, (int32_t) msg->entry.tid,
+                           (uint8_t) payload[0], tag, message});
+    if (capture != nullptr) capture->add(msg);
 
-    if (tag.find("ZygiskGadget") != std::string::npos) {
-        struct tm *local_time = localtime(&entry.tv_sec);
-        long milliseconds = entry.tv_nsec / 1000000;
-        cout << std::put_time(local_time, "%H:%M:%S") << "." << std::setw(3) << std::setfill('0') << milliseconds
-        << " " << tag << " " << entry.message << endl;
+    if (tag.find("ZygiskGadget") != string_view::npos && message.starts_with("Profiler started") &&
+        find(profiled_pids.begin(), profiled_pids.end(), msg->entry.pid) == profiled_pids.end()) {
+        profiled_pids.push_back(msg->entry.pid);
     }
+    if (measure_launches > 0 && tag.find("ZygiskGadget") != string_view::npos) {
+        bool loaded = message.starts_with("Frida-gadget loaded");
+        if (!loaded && !message.starts_with("Frida-gadget failed to load")) return;
+        size_t completed = launch_stats.completed();
+        launch_stats.on_gadget_result(msg->entry.pid, msg->entry.sec, msg->entry.nsec, loaded);
+        if (launch_stats.completed() == completed) return;
+
+        char progress[128];
+        int len = loaded ? snprintf(progress, sizeof(progress), "launch %zu/%u: %.1f ms", launch_stats.completed(),
+                                    measure_launches, (double) launch_stats.last_latency_us() / 1000.0)
+                         : snprintf(progress, sizeof(progress), "launch %zu/%u: failed", launch_stats.completed(),
+                                    measure_launches);
+        stdout_writer().write_line(msg->entry.sec, msg->entry.nsec, "measure",
+                                   string_view(progress, min<size_t>(len, sizeof(progress) - 1)));
+    }
+}
+
+static void on_target_start(struct log_msg *msg, pid_t pid, string_view proc) {
+    // A new main process means the app was restarted, its old processes are gone
+    if (proc == target_package) {
+        target_process_count = 0;
+        if (measure_launches > 0) launch_stats.on_app_start();
+    }
+    if (measure_launches > 0 && is_target_process(proc) && injected_matcher.matches(proc)) {
+        launch_stats.on_process_start(pid, msg->entry.sec, msg->entry.nsec);
+    }
+    if (is_target_pid(pid)) return;
+    if (capture != nullptr) capture->add(msg);
+    if (target_process_count == MAX_TARGET_PROCESSES) target_process_count--;
+    target_pids[target_process_count++] = pid;
+
+    char message[256];
+    int len = snprintf(message, sizeof(message), "%.*s started, pid %d", (int) proc.size(), proc.data(), pid);
+    stdout_writer().write_line(msg->entry.sec, msg->entry.nsec, "am_proc_start",
+                               string_view(message, min<size_t>(len, sizeof(message) - 1)));
 }
 
 static void process_events_buffer(struct log_msg *msg) {
@@ -101,9 +169,15 @@ static void process_events_buffer(struct log_msg *msg) {
     auto event_data = &msg->buf[msg->entry.hdr_size];
     auto event_header = reinterpret_cast<const android_event_header_t *>(event_data);
     if (event_header->tag == 30014) {
+        if (msg->entry.len < sizeof(android_event_am_proc_start)) return;
         auto am_proc_start = reinterpret_cast<const android_event_am_proc_start *>(event_data);
+        if (am_proc_start->list.type != EVENT_TYPE_LIST || am_proc_start->pid.type != EVENT_TYPE_INT ||
+            am_proc_start->process_name.type != EVENT_TYPE_STRING) return;
+        if (am_proc_start->process_name.length < 0 ||
+            (size_t) am_proc_start->process_name.length > msg->entry.len - sizeof(android_event_am_proc_start)) return;
         auto proc = string_view(am_proc_start->process_name.data,
                                 am_proc_start->process_name.length);
+        if (is_target_process(proc)) on_target_start(msg, am_proc_start->pid.data, proc);
         return;
     }
     if (event_header->tag == 3040) {
@@ -111,38 +185,157 @@ static void process_events_buffer(struct log_msg *msg) {
     }
 }
 
-[[noreturn]] void run() {
-    while (true) {
-        const unique_ptr<logger_list, decltype(&android_logger_list_free)> logger_list{
-            android_logger_list_alloc(0, 1, 0), &android_logger_list_free};
+static bool measure_done() {
+    return measure_launches > 0 && launch_stats.completed() >= measure_launches;
+}
+
+static void process_entry(struct log_msg *msg) {
+    switch (msg->entry.lid) {
+        case LOG_ID_EVENTS:
+            process_events_buffer(msg);
+            break;
+        case LOG_ID_MAIN:
+            process_main_buffer(msg);
+        default:
+            break;
+    }
+}
+
+static uint64_t reported_drops = 0;
+static uint64_t reported_stalls = 0;
+static uint32_t last_report_sec = 0;
+
+// Tells when the reader had to drop entries or the output stalled, at most once per second
+static void report_backpressure(LogPipeline &pipeline, const log_msg *msg) {
+    if (msg->entry.sec == last_report_sec) return;
+    uint64_t drops = pipeline.dropped(), stalls = stdout_writer().stalls();
+    if (drops == reported_drops && stalls == reported_stalls) return;
+
+    char message[128];
+    int len = snprintf(message, sizeof(message), "output is falling behind: %llu entries dropped, %llu output stalls",
+                       (unsigned long long) (drops - reported_drops), (unsigned long long) (stalls - reported_stalls));
+    stdout_writer().write_line(msg->entry.sec, msg->entry.nsec, "zygisk-gadget",
+                               string_view(message, min<size_t>(len, sizeof(message) - 1)));
+    reported_drops = drops;
+    reported_stalls = stalls;
+    last_report_sec = msg->entry.sec;
+}
+
+static void run(LogPipeline &pipeline) {
+    log_msg *msg;
+    while (!measure_done() && (msg = pipeline.next()) != nullptr) {
+        process_entry(msg);
+        report_backpressure(pipeline, msg);
+    }
+}
+
+static void replay(const LogcatOptions &options) {
+    auto source = FileSource::open(options.replay_path.c_str());
+    if (source == nullptr) {
+        cerr << "[!] Not a capture file: " << options.replay_path << endl;
+        return;
+    }
 
-        for (log_id id: {LOG_ID_MAIN, LOG_ID_EVENTS}) {
-            auto *logger = android_logger_open(logger_list.get(), id);
-            if (logger == nullptr) continue;
+    auto start = chrono::steady_clock::now();
+    uint64_t entries = 0;
+    int status;
+    {
+        // Lossless, the reader waits for the decoder
+        LogPipeline pipeline(*source, false);
+        follow(&pipeline);
+        log_msg *msg;
+        while (!measure_done() && (msg = pipeline.next()) != nullptr) {
+            process_entry(msg);
+            entries++;
         }
+        follow(nullptr);
+        status = pipeline.source_status();
+    }
+    stdout_writer().flush();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-        struct log_msg msg{};
-        while (true) {
-            if (android_logger_list_read(logger_list.get(), &msg) <= 0) {
-                break;
-            }
+    if (status < 0) cerr << "[!] Capture is truncated or corrupt after " << entries << " entries" << endl;
+    fprintf(stderr, "[*] Replayed %llu entries (%.1f MB) in %.3f s: %.0f entries/s, %.1f MB/s, %llu output stalls\n",
+            (unsigned long long) entries, (double) source->bytes_read() / 1e6, seconds,
+            (double) entries / seconds, (double) source->bytes_read() / 1e6 / seconds,
+            (unsigned long long) stdout_writer().stalls());
+}
+
+void logcat(const LogcatOptions &options) {
+    target_package = options.package;
+    measure_launches = options.measure;
+    // Without rules only the main process, as in the companion
+    if (options.process_rules.empty() || !injected_matcher.compile(options.process_rules, options.package)) {
+        injected_matcher.compile(options.package, options.package);
+    }
+    tag_matcher.add("ZygiskGadget");
+    for (const auto &tag : options.tags) tag_matcher.add(tag);
+    tag_matcher.build();
+    for (const auto &pattern : options.greps) message_matcher.add(pattern);
+    message_matcher.build();
+    stdout_writer().set_format(options.format);
+    if (!options.capture_dir.empty()) {
+        auto opened = LogCapture::open(options.capture_dir.c_str());
+        if (opened == nullptr) {
+            cerr << "[!] Cannot capture to " << options.capture_dir << endl;
+            return;
+        }
+        // Keep capturing when the adb shell or the host goes away
+        signal(SIGHUP, SIG_IGN);
+        signal(SIGPIPE, SIG_IGN);
+        capture = opened.release();
+    }
 
-            switch (msg.entry.lid) {
-                case LOG_ID_EVENTS:
-                    process_events_buffer(&msg);
-                    break;
-                case LOG_ID_MAIN:
-                    process_main_buffer(&msg);
-                default:
-                    break;
+    if (!options.replay_path.empty()) {
+        replay(options);
+    } else {
+        unique_ptr<LogSource> source = make_unique<LogdSource>();
+        if (!options.record_path.empty()) {
+            auto recorder = RecordingSource::open(options.record_path.c_str(), std::move(source));
+            if (recorder == nullptr) {
+                cerr << "[!] Cannot write " << options.record_path << endl;
+                return;
             }
+            recording = recorder.get();
+            source = std::move(recorder);
         }
-        sleep(1);
+        // Only left when --measure is done or on Ctrl + C. The reader may still be blocked in logd
+        // then and the process is about to exit, so the pipeline and its source are deliberately
+        // not freed.
+        auto pipeline = new LogPipeline(*source.release(), true);
+        follow(pipeline);
+        run(*pipeline);
+        follow(nullptr);
+        pipeline->stop();
+        if (recording != nullptr) recording->flush();
+        if (pipeline->dropped() > 0 || stdout_writer().stalls() > 0) {
+            cerr << "[!] " << pipeline->dropped() << " entries dropped, " << stdout_writer().stalls()
+                 << " output stalls" << endl;
+        }
+    }
+
+    stdout_writer().flush();
+    if (capture != nullptr) {
+        capture->close();
+        if (capture->stalls() > 0) cerr << "[!] " << capture->stalls() << " capture stalls" << endl;
+    }
+    if (measure_launches > 0) {
+        // Keep structured output parseable
+        auto &out = options.format == LogFormat::text ? cout : cerr;
+        out << "[*] Launch latency of " << options.package << endl << launch_stats.report() << flush;
     }
+}
+
+void logcat_interrupt() {
+    interrupted.store(true, std::memory_order_seq_cst);
+    LogPipeline *pipeline = following.load(std::memory_order_seq_cst);
+    if (pipeline != nullptr) pipeline->interrupt();
+}
 
-    pthread_exit(nullptr);
+bool logcat_interrupted() {
+    return interrupted.load(std::memory_order_relaxed);
 }
 
-void logcat() {
-    run();
+vector<pid_t> logcat_profiled_pids() {
+    return profiled_pids;
 }
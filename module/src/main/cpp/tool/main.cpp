@@ -1,93 +1,97 @@
+#include <sys/stat.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <iostream>
 #include <fstream>
-#include <thread>
 #include <regex>
+#include <cerrno>
+#include <climits>
 #include <csignal>
+#include <optional>
 
+#include "config.h"
+#include "daemon.h"
+#include "log_writer.h"
 #include "logcat.h"
-#include "nlohmann/json.hpp"
+#include "process_matcher.h"
+#include "profiler.h"
 
 using namespace std;
-using json = nlohmann::json;
 
-const char* short_options = "hcp:d:";
+const char* short_options = "hcPp:d:n:m:r:R:C:t:g:f:";
 const struct option long_options[] = {
         {"help", no_argument, nullptr, 'h'},
         {"config", no_argument, nullptr, 'c'},
+        {"profile", no_argument, nullptr, 'P'},
         {"package", required_argument, nullptr, 'p'},
         {"delay", required_argument, nullptr, 'd'},
+        {"process", required_argument, nullptr, 'n'},
+        {"measure", required_argument, nullptr, 'm'},
+        {"record", required_argument, nullptr, 'r'},
+        {"replay", required_argument, nullptr, 'R'},
+        {"capture", required_argument, nullptr, 'C'},
+        {"tag", required_argument, nullptr, 't'},
+        {"grep", required_argument, nullptr, 'g'},
+        {"format", required_argument, nullptr, 'f'},
         {nullptr, 0, nullptr, 0}
 };
 
 void show_usage() {
     printf("Usage: ./zygisk-gadget -p <packageName> <option(s)>\n");
+    printf("       ./zygisk-gadget daemon             Keep the config in memory and push changes to the module\n");
+    printf("       ./zygisk-gadget ctl <request>      Change the config of a running daemon, see ctl without a request\n");
     printf(" Options:\n");
     printf("  -d, --delay <microseconds>             Delay in microseconds before loading frida-gadget\n");
+    printf("  -n, --process <rule>                   Inject into the processes of <packageName> matching <rule> instead of the main process only (repeatable):\n");
+    printf("                                         <packageName>, :<name> or <packageName>:<name>, * and ? globs in <name>\n");
     printf("  -c, --config                           Activate config mode (default: false)\n");
+    printf("  -P, --profile                          Sample native stacks of the target, pulled to /data/local/tmp/<packageName>.folded on exit\n");
+    printf("  -m, --measure <launches>               Report process start to gadget loaded latency over N launches, then exit\n");
+    printf("  -r, --record <file>                    Also save the raw log records to a capture file\n");
+    printf("  -R, --replay <file>                    Read a capture file instead of the live log, then exit (no root needed)\n");
+    printf("  -C, --capture <dir>                    Also save the followed lines to rotating LZ4 compressed segments in <dir>\n");
+    printf("  -t, --tag <text>                       Also show lines of any process whose tag contains <text> (repeatable)\n");
+    printf("  -g, --grep <text>                      Also show lines of any process whose message contains <text> (repeatable)\n");
+    printf("  -f, --format <text|jsonl|bin>          Output format of the followed lines (default: text)\n");
     printf("  -h, --help                             Show help\n\n");
 }
 
-json get_json(const std::string& path) {
-    std::ifstream file(path);
-    if (file.is_open()) {
-        json j;
-        file >> j;
-        file.close();
-        return j;
-    } else {
-        return nullptr;
+// A running daemon owns the config and persists changes itself, otherwise the file is updated
+bool set_config(const string& pkg, uint delay, bool config_mode, bool profile, const string& rules) {
+    string reply;
+    if (control_request("set " + pkg + " " + to_string(delay) + " " + to_string(config_mode) + " " +
+                        to_string(profile) + (rules.empty() ? "" : " " + rules), reply)) {
+        if (!reply.starts_with("ok")) cerr << "[!] zygisk-gadget daemon: " << reply << endl;
+        return reply.starts_with("ok");
     }
+    return update_config([&](GadgetConfig& config) {
+        set_package_name(config, pkg);
+        config.delay = delay;
+        config.config_mode = config_mode;
+        config.profile = profile;
+        set_process_rules(config, rules);
+    });
 }
 
-void update_json(json& j, const std::vector<std::string>& key_path, const json& value) {
-    json* current = &j;
-    // Navigate to the correct position in the JSON object
-    for (size_t i = 0; i < key_path.size(); ++i) {
-        const std::string& key = key_path[i];
-
-        if (current->contains(key)) {
-            if (i == key_path.size() - 1) {
-                // Last key in the path, update the value
-                (*current)[key] = value;
-            } else {
-                // Navigate deeper into the JSON object
-                current = &((*current)[key]);
-            }
-        } else {
-            std::cerr << "Key path element '" << key << "' not found in JSON." << std::endl;
-            exit(-1);
-        }
-    }
-}
-
-void write_json(const json& j, const string& file_path) {
-    ofstream file(file_path);
-    if (!file.is_open()) {
-        cerr << "Unable to write to JSON file: " << file_path << endl;
-        exit(-1);
-    }
-    file << std::setw(4) << j << std::endl; // Pretty print with 4 spaces indentation
-}
-
-uint check_delay_optarg(char* option) {
+// Empty if the option is not an unsigned int
+std::optional<uint> check_delay_optarg(char* option) {
     // Check if the input starts with a minus sign
     if (option[0] == '-') {
         std::cerr << "Negative value is not allowed: " << option << std::endl;
-        return -1;
+        return std::nullopt;
     }
     char *endptr;
-    uint temp_value = strtoul(option, &endptr, 10);
+    errno = 0;
+    unsigned long temp_value = strtoul(option, &endptr, 10);
     if (*endptr != '\0') {
         std::cerr << "Invalid characters found in the input: " << option << std::endl;
-        return -1;
+        return std::nullopt;
     }
-    if (temp_value > UINT_MAX) {
+    if (errno == ERANGE || temp_value > UINT_MAX) {
         std::cerr << "Value out of range for unsigned int: " << option << std::endl;
-        return -1;
+        return std::nullopt;
     }
-    return temp_value;
+    return (uint) temp_value;
 }
 
 namespace fs = std::filesystem;
@@ -103,38 +107,110 @@ std::string find_matching_file(const fs::path& directory, const std::regex& patt
     return ""; // Return an empty string if no match is found
 }
 
-// Function to handle signals like Ctrl + C (SIGINT)
-void signalHandler(int signal) {
-    json j = get_json(config_file_path);
-    std::vector<std::string> key_path;
-    key_path = {"package", "name"};
-    update_json(j, key_path, "com.hackcatml.test");
-    write_json(j, config_file_path);
+string target_pkg;
+bool profile_mode = false;
+
+// Stops the profilers of the target, whose final output replaces the periodic one at src
+void stop_profilers(const std::string& src) {
+    struct stat before{};
+    stat(src.c_str(), &before);
+    bool requested = false;
+    for (pid_t pid : logcat_profiled_pids()) {
+        // Only while the pid is still a process of the target, SIGPROF kills a process without the profiler
+        std::ifstream cmdline("/proc/" + to_string(pid) + "/cmdline");
+        string name;
+        getline(cmdline, name, '\0');
+        if (name != target_pkg && !name.starts_with(target_pkg + ":")) continue;
+        union sigval value{};
+        value.sival_int = PROFILER_STOP_REQUEST;
+        if (sigqueue(pid, SIGPROF, value) == 0) requested = true;
+    }
+    // A profiler notices the request within a drain interval
+    for (int i = 0; requested && i < 40; i++) {
+        usleep(50000);
+        struct stat st{};
+        if (stat(src.c_str(), &st) == 0 && (st.st_ino != before.st_ino || st.st_mtim.tv_sec != before.st_mtim.tv_sec ||
+                                              st.st_mtim.tv_nsec != before.st_mtim.tv_nsec)) {
+            return;
+        }
+    }
+}
+
+// Copy the folded stacks written by the in-process profiler next to the tool
+void pull_profile() {
+    std::string src = "/data/data/" + target_pkg + "/" + PROFILER_OUTPUT_NAME;
+    std::string dst = "/data/local/tmp/" + target_pkg + ".folded";
+    stop_profilers(src);
+    std::ifstream in(src, std::ios::binary);
+    if (!in.is_open()) {
+        cout << "[!] No profile found in " << src << endl;
+        return;
+    }
+    std::ofstream out(dst, std::ios::binary);
+    out << in.rdbuf();
+    cout << "[*] Profile saved to " << dst << endl;
+}
+
+void restore_config() {
+    if (profile_mode) pull_profile();
+
+    string reply;
+    if (control_request("target " CONFIG_DEFAULT_PACKAGE, reply)) return;
+    update_config([](GadgetConfig& config) {
+        set_package_name(config, CONFIG_DEFAULT_PACKAGE);
+        set_process_rules(config, "");
+    });
+}
+
+bool replay_mode = false;
 
-    exit(signal);
+// Ctrl + C (SIGINT) only raises a flag: logcat() returns after writing out what it followed and
+// main() restores the config. A second Ctrl + C exits at once.
+void signalHandler(int signal) {
+    logcat_interrupt();
+    std::signal(signal, SIG_DFL);
 }
 
 int main(int argc, char* argv[]) {
-    uint uid = getuid();
-    if (uid != 0) {
-        cout << "Need root to run this program" << endl;
-        return -1;
+    if (argc > 1 && strcmp(argv[1], "daemon") == 0) {
+        if (getuid() != 0) {
+            cout << "Need root to run this program" << endl;
+            return -1;
+        }
+        return run_daemon();
+    }
+    if (argc > 1 && strcmp(argv[1], "ctl") == 0) {
+        return run_ctl(argc - 2, argv + 2);
     }
 
     int option;
     string pkg;
+    string rules;
     uint delay = 0;
     bool isValidArg = true, config_mode = false;
+    LogcatOptions logcat_options;
 
     while((option = getopt_long(argc, argv, short_options, long_options, nullptr)) != -1) {
         switch (option) {
             case 'p':
                 pkg = optarg;
+                if (pkg.size() >= CONFIG_PACKAGE_MAX) {
+                    cerr << "Package name too long: " << pkg << endl;
+                    return -1;
+                }
+                break;
+            case 'n':
+                if (optarg[0] == '\0' || strpbrk(optarg, " \t\r\n") != nullptr) {
+                    cerr << "Invalid process rule: '" << optarg << "'" << endl;
+                    return -1;
+                }
+                rules += (rules.empty() ? "" : " ") + string(optarg);
                 break;
             case 'd': {
-                delay = check_delay_optarg(optarg);
-                if (delay == -1)
+                auto value = check_delay_optarg(optarg);
+                if (!value)
                     return -1;
+                delay = *value;
                 break;
             }
             case 'c':
@@ -154,6 +230,44 @@ int main(int argc, char* argv[]) {
                 }
                 break;
             }
+            case 'P':
+                profile_mode = true;
+                break;
+            case 'm': {
+                auto value = check_delay_optarg(optarg);
+                if (!value)
+                    return -1;
+                logcat_options.measure = *value;
+                break;
+            }
+            case 'r':
+                logcat_options.record_path = optarg;
+                break;
+            case 'R':
+                logcat_options.replay_path = optarg;
+                replay_mode = true;
+                break;
+            case 'C':
+                logcat_options.capture_dir = optarg;
+                break;
+            case 't':
+                logcat_options.tags.emplace_back(optarg);
+                break;
+            case 'g':
+                logcat_options.greps.emplace_back(optarg);
+                break;
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    logcat_options.format = LogFormat::text;
+                } else if (strcmp(optarg, "jsonl") == 0) {
+                    logcat_options.format = LogFormat::jsonl;
+                } else if (strcmp(optarg, "bin") == 0) {
+                    logcat_options.format = LogFormat::bin;
+                } else {
+                    std::cerr << "Unknown format: " << optarg << std::endl;
+                    return -1;
+                }
+                break;
             case 'h':
                 show_usage();
                 return -1;
@@ -168,23 +282,40 @@ int main(int argc, char* argv[]) {
         show_usage();
         return -1;
     }
-
-    json j = get_json(config_file_path);
-    std::vector<std::string> key_path;
-    key_path = {"package", "name"};
-    update_json(j, key_path, pkg);
-    key_path = {"package" , "delay"};
-    update_json(j, key_path, delay);
-    key_path = {"package", "mode", "config"};
-    update_json(j, key_path, config_mode);
-
-    std::thread t(write_json, j, config_file_path);
-    t.detach();
+    logcat_options.package = pkg;
+    logcat_options.process_rules = rules;
+    std::string_view invalid = ProcessMatcher::invalid_rule(rules, pkg);
+    if (!invalid.empty()) {
+        cerr << "Invalid process rule " << invalid << ", expected " << pkg << ", :<name> or " << pkg << ":<name>"
+             << endl;
+        return -1;
+    }
+    ProcessMatcher matcher;
+    if (rules.size() >= CONFIG_RULES_MAX || !matcher.compile(rules, pkg)) {
+        cerr << "Too many or too complex process rules" << endl;
+        return -1;
+    }
 
     // Register signal handler for SIGINT (Ctrl + C)
     std::signal(SIGINT, signalHandler);
 
-    logcat();
+    if (replay_mode) {
+        logcat(logcat_options);
+        return logcat_interrupted() ? SIGINT : 0;
+    }
+
+    uint uid = getuid();
+    if (uid != 0) {
+        cout << "Need root to run this program" << endl;
+        return -1;
+    }
+
+    if (!set_config(pkg, delay, config_mode, profile_mode, rules)) return -1;
+    target_pkg = pkg;
+
+    // Returns when --measure collected its launches or on Ctrl + C
+    logcat(logcat_options);
+    restore_config();
 
-    return 0;
+    return logcat_interrupted() ? SIGINT : 0;
 }
@@ -0,0 +1,88 @@
+#include <cstring>
+#include <queue>
+
+#include "matcher.h"
+
+void MultiMatcher::add(std::string_view pattern) {
+    if (!pattern.empty()) patterns.emplace_back(pattern);
+}
+
+void MultiMatcher::build() {
+    // Bytes that occur in no pattern behave the same everywhere and share class 0
+    memset(byte_class, 0, sizeof(byte_class));
+    classes = 1;
+    for (const auto &pattern : patterns) {
+        for (unsigned char c : pattern) {
+            if (byte_class[c] == 0) byte_class[c] = (uint8_t) classes++;
+        }
+    }
+    if (classes > 256) classes = 256;  // cannot happen with 255 pattern bytes + class 0
+
+    // Trie, state 0 is the root and 0 in next[] also means "no edge" until failures are resolved
+    next.assign(classes, 0);
+    output.assign(1, 0);
+    for (const auto &pattern : patterns) {
+        uint32_t state = 0;
+        for (unsigned char c : pattern) {
+            uint32_t &edge = next[state * classes + byte_class[c]];
+            if (edge == 0) {
+                edge = (uint32_t) output.size();
+                next.resize(next.size() + classes, 0);
+                output.push_back(0);
+            }
+            state = next[state * classes + byte_class[c]];
+        }
+        output[state] = 1;
+    }
+
+    // Breadth-first, so the failure state of every state is complete before its children
+    std::vector<uint32_t> fail(output.size(), 0);
+    std::queue<uint32_t> queue;
+    for (uint32_t k = 0; k < classes; k++) {
+        if (next[k] != 0) queue.push(next[k]);
+    }
+    while (!queue.empty()) {
+        uint32_t state = queue.front();
+        queue.pop();
+        output[state] |= output[fail[state]];
+        for (uint32_t k = 0; k < classes; k++) {
+            uint32_t child = next[state * classes + k];
+            if (child != 0) {
+                fail[child] = next[fail[state] * classes + k];
+                queue.push(child);
+            } else {
+                next[state * classes + k] = next[fail[state] * classes + k];
+            }
+        }
+    }
+
+    // With a single possible first byte the root can skip ahead with memchr()
+    single_first_byte = -1;
+    for (const auto &pattern : patterns) {
+        int first = (unsigned char) pattern[0];
+        if (single_first_byte == -1) {
+            single_first_byte = first;
+        } else if (single_first_byte != first) {
+            single_first_byte = -2;
+            break;
+        }
+    }
+}
+
+bool MultiMatcher::contains_any(std::string_view text) const {
+    if (patterns.empty()) return false;
+    const uint32_t *table = next.data();
+    const uint8_t *out = output.data();
+    auto p = reinterpret_cast<const unsigned char *>(text.data());
+    auto end = p + text.size();
+    uint32_t state = 0;
+    while (p < end) {
+        if (state == 0 && single_first_byte >= 0) {
+            p = static_cast<const unsigned char *>(memchr(p, single_first_byte, end - p));
+            if (p == nullptr) return false;
+        }
+        state = table[state * classes + byte_class[*p++]];
+        if (out[state]) return true;
+    }
+    return false;
+}
@@ -0,0 +1,799 @@
+#include <link.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "unwinder.h"
+#include "xdl.h"
+
+#define UNWIND_MAX_MODULES 1024
+#define UNWIND_ROW_CACHE_SIZE 1024   // must be a power of two
+#define UNWIND_STATE_STACK 4         // DW_CFA_remember_state depth
+
+#if defined(__aarch64__) || defined(__x86_64__)
+
+// Only the registers needed to walk frames are tracked: callee-saved ones, the frame pointer,
+// the stack pointer and the return address column.
+#if defined(__aarch64__)
+#define REG_SLOTS 13         // x19..x30, sp
+#define REG_SLOT_SP 12
+#define REG_SLOT_FP 10       // x29
+#define DWARF_RA_REG 30      // x30 (lr)
+static int dwarf_to_slot(uint64_t reg) {
+    if (reg >= 19 && reg <= 30) return (int) reg - 19;
+    if (reg == 31) return REG_SLOT_SP;
+    return -1;
+}
+#else
+#define REG_SLOTS 8          // rbx, rbp, rsp, r12..r15, return address
+#define REG_SLOT_SP 2
+#define REG_SLOT_FP 1        // rbp
+#define DWARF_RA_REG 16
+static int dwarf_to_slot(uint64_t reg) {
+    switch (reg) {
+        case 3: return 0;
+        case 6: return 1;
+        case 7: return 2;
+        case 12: case 13: case 14: case 15: return (int) reg - 9;
+        case 16: return 7;
+        default: return -1;
+    }
+}
+#endif
+
+// DWARF call frame instructions
+#define DW_CFA_nop 0x00
+#define DW_CFA_set_loc 0x01
+#define DW_CFA_advance_loc1 0x02
+#define DW_CFA_advance_loc2 0x03
+#define DW_CFA_advance_loc4 0x04
+#define DW_CFA_offset_extended 0x05
+#define DW_CFA_restore_extended 0x06
+#define DW_CFA_undefined 0x07
+#define DW_CFA_same_value 0x08
+#define DW_CFA_register 0x09
+#define DW_CFA_remember_state 0x0a
+#define DW_CFA_restore_state 0x0b
+#define DW_CFA_def_cfa 0x0c
+#define DW_CFA_def_cfa_register 0x0d
+#define DW_CFA_def_cfa_offset 0x0e
+#define DW_CFA_def_cfa_expression 0x0f
+#define DW_CFA_expression 0x10
+#define DW_CFA_offset_extended_sf 0x11
+#define DW_CFA_def_cfa_sf 0x12
+#define DW_CFA_def_cfa_offset_sf 0x13
+#define DW_CFA_val_offset 0x14
+#define DW_CFA_val_offset_sf 0x15
+#define DW_CFA_val_expression 0x16
+#define DW_CFA_AARCH64_negate_ra_state 0x2d
+#define DW_CFA_GNU_args_size 0x2e
+#define DW_CFA_GNU_negative_offset_extended 0x2f
+#define DW_CFA_advance_loc 0x40
+#define DW_CFA_offset 0x80
+#define DW_CFA_restore 0xc0
+
+// Pointer encodings used by .eh_frame and .eh_frame_hdr
+#define DW_EH_PE_omit 0xff
+#define DW_EH_PE_absptr 0x00
+#define DW_EH_PE_uleb128 0x01
+#define DW_EH_PE_udata2 0x02
+#define DW_EH_PE_udata4 0x03
+#define DW_EH_PE_udata8 0x04
+#define DW_EH_PE_sleb128 0x09
+#define DW_EH_PE_sdata2 0x0a
+#define DW_EH_PE_sdata4 0x0b
+#define DW_EH_PE_sdata8 0x0c
+#define DW_EH_PE_pcrel 0x10
+#define DW_EH_PE_datarel 0x30
+#define DW_EH_PE_indirect 0x80
+
+enum RuleKind : uint8_t {
+    RULE_SAME = 0,
+    RULE_UNDEFINED,
+    RULE_OFFSET,      // saved at CFA + value
+    RULE_VAL_OFFSET,  // value is CFA + value
+    RULE_REGISTER,    // saved in register slot value
+};
+
+struct UnwindRow {
+    int64_t cfa_offset;
+    uint8_t cfa_slot;            // 0xff: no CFA rule, the frame cannot be unwound by CFI
+    uint8_t kind[REG_SLOTS];
+    int32_t value[REG_SLOTS];
+};
+
+struct UnwindContext {
+    uintptr_t pc;
+    uintptr_t regs[REG_SLOTS];
+    UnwindStack stack;
+};
+
+struct UnwindModule {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t eh_frame_hdr;
+};
+
+struct ModuleTable {
+    size_t count;
+    UnwindModule modules[UNWIND_MAX_MODULES];
+};
+
+struct RowCacheEntry {
+    std::atomic<uintptr_t> key;
+    UnwindRow row;
+};
+
+// Two module tables: unwind_refresh_modules() fills the inactive one and publishes it, so a
+// sampler interrupting the refresh keeps reading a consistent table.
+static ModuleTable module_tables[2];
+static std::atomic<ModuleTable *> active_modules{nullptr};
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static RowCacheEntry row_cache[UNWIND_ROW_CACHE_SIZE];
+static constexpr uintptr_t ROW_CACHE_BUSY = 1;
+
+static uint64_t read_uleb128(const uint8_t *&p, const uint8_t *end) {
+    uint64_t result = 0;
+    unsigned shift = 0;
+    while (p < end) {
+        uint8_t byte = *p++;
+        if (shift < 64) result |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+        if (!(byte & 0x80)) break;
+    }
+    return result;
+}
+
+static int64_t read_sleb128(const uint8_t *&p, const uint8_t *end) {
+    int64_t result = 0;
+    unsigned shift = 0;
+    uint8_t byte = 0;
+    while (p < end) {
+        byte = *p++;
+        if (shift < 64) result |= (int64_t) (byte & 0x7f) << shift;
+        shift += 7;
+        if (!(byte & 0x80)) break;
+    }
+    if (shift < 64 && (byte & 0x40)) result |= -((int64_t) 1 << shift);
+    return result;
+}
+
+template <typename T>
+static bool read_raw(const uint8_t *&p, const uint8_t *end, T &out) {
+    if (end - p < (ptrdiff_t) sizeof(T)) return false;
+    memcpy(&out, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+static bool read_encoded(const uint8_t *&p, const uint8_t *end, uint8_t enc, uintptr_t data_base,
+                         uintptr_t &out) {
+    if (enc == DW_EH_PE_omit) return false;
+
+    const uint8_t *start = p;
+    uintptr_t value;
+    switch (enc & 0x0f) {
+        case DW_EH_PE_absptr: { uintptr_t v; if (!read_raw(p, end, v)) return false; value = v; break; }
+        case DW_EH_PE_uleb128: value = (uintptr_t) read_uleb128(p, end); break;
+        case DW_EH_PE_sleb128: value = (uintptr_t) read_sleb128(p, end); break;
+        case DW_EH_PE_udata2: { uint16_t v; if (!read_raw(p, end, v)) return false; value = v; break; }
+        case DW_EH_PE_udata4: { uint32_t v; if (!read_raw(p, end, v)) return false; value = v; break; }
+        case DW_EH_PE_udata8: { uint64_t v; if (!read_raw(p, end, v)) return false; value = v; break; }
+        case DW_EH_PE_sdata2: { int16_t v; if (!read_raw(p, end, v)) return false; value = (uintptr_t) (intptr_t) v; break; }
+        case DW_EH_PE_sdata4: { int32_t v; if (!read_raw(p, end, v)) return false; value = (uintptr_t) (intptr_t) v; break; }
+        case DW_EH_PE_sdata8: { int64_t v; if (!read_raw(p, end, v)) return false; value = (uintptr_t) v; break; }
+        default: return false;
+    }
+
+    switch (enc & 0x70) {
+        case 0: break;
+        case DW_EH_PE_pcrel: value += (uintptr_t) start; break;
+        case DW_EH_PE_datarel: value += data_base; break;
+        default: return false;  // textrel / funcrel / aligned are not emitted by our toolchains
+    }
+
+    if (enc & DW_EH_PE_indirect) value = *reinterpret_cast<const uintptr_t *>(value);
+    out = value;
+    return true;
+}
+
+// Reads a CIE/FDE length field, returns the end of the record.
+static const uint8_t *read_record_length(const uint8_t *&p) {
+    uint32_t length;
+    memcpy(&length, p, sizeof(length));
+    p += sizeof(length);
+    if (length == 0xffffffff) {
+        uint64_t length64;
+        memcpy(&length64, p, sizeof(length64));
+        p += sizeof(length64);
+        return p + length64;
+    }
+    return p + length;
+}
+
+struct CieInfo {
+    uint64_t code_align;
+    int64_t data_align;
+    uint64_t ra_reg;
+    uint8_t fde_enc;
+    bool has_augmentation_data;
+    const uint8_t *instructions;
+    const uint8_t *end;
+};
+
+static bool parse_cie(const uint8_t *cie, CieInfo &info) {
+    const uint8_t *p = cie;
+    const uint8_t *end = read_record_length(p);
+    uint32_t cie_id;
+    if (!read_raw(p, end, cie_id) || cie_id != 0) return false;
+
+    uint8_t version;
+    if (!read_raw(p, end, version) || (version != 1 && version != 3 && version != 4)) return false;
+
+    const char *augmentation = reinterpret_cast<const char *>(p);
+    while (p < end && *p) p++;
+    if (p++ >= end) return false;
+
+    if (version == 4) p += 2;  // address_size, segment_selector_size
+    if (augmentation[0] == 'e' && augmentation[1] == 'h') p += sizeof(uintptr_t);
+
+    info.code_align = read_uleb128(p, end);
+    info.data_align = read_sleb128(p, end);
+    if (version == 1) {
+        info.ra_reg = *p++;
+    } else {
+        info.ra_reg = read_uleb128(p, end);
+    }
+    info.fde_enc = DW_EH_PE_absptr;
+    info.has_augmentation_data = false;
+
+    if (augmentation[0] == 'z') {
+        info.has_augmentation_data = true;
+        uint64_t aug_length = read_uleb128(p, end);
+        const uint8_t *aug_end = p + aug_length;
+        for (const char *c = augmentation + 1; *c && p < aug_end; c++) {
+            switch (*c) {
+                case 'R':
+                    info.fde_enc = *p++;
+                    break;
+                case 'L':
+                    p++;
+                    break;
+                case 'P': {
+                    uint8_t enc = *p++;
+                    uintptr_t personality;
+                    if (!read_encoded(p, aug_end, enc & ~DW_EH_PE_indirect, 0, personality)) return false;
+                    break;
+                }
+                default:  // 'S', 'B', 'G' carry no data
+                    break;
+            }
+        }
+        p = aug_end;
+    }
+
+    info.instructions = p;
+    info.end = end;
+    return p <= end;
+}
+
+static void reset_row(UnwindRow &row) {
+    row.cfa_offset = 0;
+    row.cfa_slot = 0xff;
+    memset(row.kind, RULE_SAME, sizeof(row.kind));
+    memset(row.value, 0, sizeof(row.value));
+}
+
+static void set_rule(UnwindRow &row, uint64_t reg, RuleKind kind, int64_t value) {
+    int slot = dwarf_to_slot(reg);
+    if (slot < 0) return;
+    row.kind[slot] = kind;
+    row.value[slot] = (int32_t) value;
+}
+
+// Runs CFA instructions until the row covering target_pc is built. Returns false on anything the
+// evaluator does not model (DWARF expressions, untracked CFA registers, malformed data).
+static bool execute_cfa(const uint8_t *p, const uint8_t *end, const CieInfo &cie, uintptr_t loc,
+                        uintptr_t target_pc, const UnwindRow &initial, UnwindRow &row) {
+    UnwindRow stack[UNWIND_STATE_STACK];
+    size_t depth = 0;
+
+    while (p < end && loc <= target_pc) {
+        uint8_t op = *p++;
+        uint8_t high = op & 0xc0;
+        uint8_t low = op & 0x3f;
+
+        if (high == DW_CFA_advance_loc) {
+            loc += low * cie.code_align;
+            continue;
+        }
+        if (high == DW_CFA_offset) {
+            set_rule(row, low, RULE_OFFSET, (int64_t) read_uleb128(p, end) * cie.data_align);
+            continue;
+        }
+        if (high == DW_CFA_restore) {
+            int slot = dwarf_to_slot(low);
+            if (slot >= 0) {
+                row.kind[slot] = initial.kind[slot];
+                row.value[slot] = initial.value[slot];
+            }
+            continue;
+        }
+
+        switch (op) {
+            case DW_CFA_nop:
+                break;
+            case DW_CFA_set_loc:
+                if (!read_encoded(p, end, cie.fde_enc, 0, loc)) return false;
+                break;
+            case DW_CFA_advance_loc1: {
+                uint8_t delta;
+                if (!read_raw(p, end, delta)) return false;
+                loc += delta * cie.code_align;
+                break;
+            }
+            case DW_CFA_advance_loc2: {
+                uint16_t delta;
+                if (!read_raw(p, end, delta)) return false;
+                loc += delta * cie.code_align;
+                break;
+            }
+            case DW_CFA_advance_loc4: {
+                uint32_t delta;
+                if (!read_raw(p, end, delta)) return false;
+                loc += delta * cie.code_align;
+                break;
+            }
+            case DW_CFA_offset_extended: {
+                uint64_t reg = read_uleb128(p, end);
+                set_rule(row, reg, RULE_OFFSET, (int64_t) read_uleb128(p, end) * cie.data_align);
+                break;
+            }
+            case DW_CFA_offset_extended_sf: {
+                uint64_t reg = read_uleb128(p, end);
+                set_rule(row, reg, RULE_OFFSET, read_sleb128(p, end) * cie.data_align);
+                break;
+            }
+            case DW_CFA_GNU_negative_offset_extended: {
+                uint64_t reg = read_uleb128(p, end);
+                set_rule(row, reg, RULE_OFFSET, -(int64_t) read_uleb128(p, end) * cie.data_align);
+                break;
+            }
+            case DW_CFA_val_offset: {
+                uint64_t reg = read_uleb128(p, end);
+                set_rule(row, reg, RULE_VAL_OFFSET, (int64_t) read_uleb128(p, end) * cie.data_align);
+                break;
+            }
+            case DW_CFA_val_offset_sf: {
+                uint64_t reg = read_uleb128(p, end);
+                set_rule(row, reg, RULE_VAL_OFFSET, read_sleb128(p, end) * cie.data_align);
+                break;
+            }
+            case DW_CFA_restore_extended: {
+                int slot = dwarf_to_slot(read_uleb128(p, end));
+                if (slot >= 0) {
+                    row.kind[slot] = initial.kind[slot];
+                    row.value[slot] = initial.value[slot];
+                }
+                break;
+            }
+            case DW_CFA_undefined:
+                set_rule(row, read_uleb128(p, end), RULE_UNDEFINED, 0);
+                break;
+            case DW_CFA_same_value:
+                set_rule(row, read_uleb128(p, end), RULE_SAME, 0);
+                break;
+            case DW_CFA_register: {
+                uint64_t reg = read_uleb128(p, end);
+                int source = dwarf_to_slot(read_uleb128(p, end));
+                if (source < 0) {
+                    set_rule(row, reg, RULE_UNDEFINED, 0);
+                } else {
+                    set_rule(row, reg, RULE_REGISTER, source);
+                }
+                break;
+            }
+            case DW_CFA_remember_state:
+                if (depth == UNWIND_STATE_STACK) return false;
+                stack[depth++] = row;
+                break;
+            case DW_CFA_restore_state:
+                // like libgcc and libunwind, the CFA rule is part of the remembered state
+                if (depth == 0) return false;
+                row = stack[--depth];
+                break;
+            case DW_CFA_def_cfa: {
+                int slot = dwarf_to_slot(read_uleb128(p, end));
+                row.cfa_slot = slot < 0 ? 0xff : (uint8_t) slot;
+                row.cfa_offset = (int64_t) read_uleb128(p, end);
+                break;
+            }
+            case DW_CFA_def_cfa_sf: {
+                int slot = dwarf_to_slot(read_uleb128(p, end));
+                row.cfa_slot = slot < 0 ? 0xff : (uint8_t) slot;
+                row.cfa_offset = read_sleb128(p, end) * cie.data_align;
+                break;
+            }
+            case DW_CFA_def_cfa_register: {
+                int slot = dwarf_to_slot(read_uleb128(p, end));
+                row.cfa_slot = slot < 0 ? 0xff : (uint8_t) slot;
+                break;
+            }
+            case DW_CFA_def_cfa_offset:
+                row.cfa_offset = (int64_t) read_uleb128(p, end);
+                break;
+            case DW_CFA_def_cfa_offset_sf:
+                row.cfa_offset = read_sleb128(p, end) * cie.data_align;
+                break;
+            case DW_CFA_def_cfa_expression:
+                return false;
+            case DW_CFA_expression:
+            case DW_CFA_val_expression: {
+                uint64_t reg = read_uleb128(p, end);
+                uint64_t length = read_uleb128(p, end);
+                p += length;
+                set_rule(row, reg, RULE_UNDEFINED, 0);
+                break;
+            }
+            case DW_CFA_GNU_args_size:
+                read_uleb128(p, end);
+                break;
+            case DW_CFA_AARCH64_negate_ra_state:
+                // return addresses are stripped of PAC bits when stepping
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+static const UnwindModule *find_module(uintptr_t pc) {
+    const ModuleTable *table = active_modules.load(std::memory_order_acquire);
+    if (table == nullptr) return nullptr;
+
+    size_t lo = 0, hi = table->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const UnwindModule &module = table->modules[mid];
+        if (pc < module.start) {
+            hi = mid;
+        } else if (pc >= module.end) {
+            lo = mid + 1;
+        } else {
+            return &module;
+        }
+    }
+    return nullptr;
+}
+
+// Binary search over the sorted (initial_loc, fde) table of .eh_frame_hdr.
+static const uint8_t *find_fde(uintptr_t eh_frame_hdr, uintptr_t pc) {
+    auto hdr = reinterpret_cast<const uint8_t *>(eh_frame_hdr);
+    if (hdr[0] != 1) return nullptr;
+    uint8_t eh_frame_ptr_enc = hdr[1];
+    uint8_t fde_count_enc = hdr[2];
+    uint8_t table_enc = hdr[3];
+    // only the datarel|sdata4 table is binary-searchable in place, which is what lld/ld emit
+    if (table_enc != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) return nullptr;
+
+    const uint8_t *p = hdr + 4;
+    const uint8_t *end = p + 2 * sizeof(uint64_t);
+    uintptr_t eh_frame, fde_count;
+    if (!read_encoded(p, end, eh_frame_ptr_enc, eh_frame_hdr, eh_frame)) return nullptr;
+    if (!read_encoded(p, end, fde_count_enc, eh_frame_hdr, fde_count) || fde_count == 0) return nullptr;
+
+    auto table = reinterpret_cast<const int32_t *>(p);
+    intptr_t rel_pc = (intptr_t) (pc - eh_frame_hdr);
+    if (rel_pc < table[0]) return nullptr;
+
+    size_t lo = 0, hi = fde_count;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (table[mid * 2] <= rel_pc) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return reinterpret_cast<const uint8_t *>(eh_frame_hdr + table[lo * 2 + 1]);
+}
+
+static bool compute_row(uintptr_t pc, UnwindRow &row) {
+    reset_row(row);
+
+    const UnwindModule *module = find_module(pc);
+    if (module == nullptr || module->eh_frame_hdr == 0) return false;
+
+    const uint8_t *fde = find_fde(module->eh_frame_hdr, pc);
+    if (fde == nullptr) return false;
+
+    const uint8_t *p = fde;
+    const uint8_t *fde_end = read_record_length(p);
+    const uint8_t *cie_pointer = p;
+    uint32_t cie_offset;
+    if (!read_raw(p, fde_end, cie_offset) || cie_offset == 0) return false;
+
+    CieInfo cie{};
+    if (!parse_cie(cie_pointer - cie_offset, cie)) return false;
+    if (cie.ra_reg != DWARF_RA_REG) return false;
+
+    uintptr_t pc_begin, pc_range;
+    if (!read_encoded(p, fde_end, cie.fde_enc, 0, pc_begin)) return false;
+    if (!read_encoded(p, fde_end, cie.fde_enc & 0x0f, 0, pc_range)) return false;
+    if (pc < pc_begin || pc >= pc_begin + pc_range) return false;
+
+    if (cie.has_augmentation_data) {
+        uint64_t aug_length = read_uleb128(p, fde_end);
+        p += aug_length;
+    }
+
+    UnwindRow initial;
+    reset_row(initial);
+    if (!execute_cfa(cie.instructions, cie.end, cie, 0, UINTPTR_MAX, initial, initial)) return false;
+    row = initial;
+    if (!execute_cfa(p, fde_end, cie, pc_begin, pc, initial, row)) {
+        reset_row(row);
+        return false;
+    }
+    return row.cfa_slot != 0xff;
+}
+
+static bool lookup_row(uintptr_t pc, UnwindRow &row) {
+    RowCacheEntry &entry = row_cache[(pc ^ (pc >> 12)) & (UNWIND_ROW_CACHE_SIZE - 1)];
+
+    uintptr_t key = entry.key.load(std::memory_order_acquire);
+    if (key == pc) {
+        row = entry.row;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.key.load(std::memory_order_relaxed) == pc) return row.cfa_slot != 0xff;
+    }
+
+    compute_row(pc, row);
+
+    // Claim the slot; if another thread (or a nested signal) owns it, just skip caching.
+    if (key != ROW_CACHE_BUSY &&
+        entry.key.compare_exchange_strong(key, ROW_CACHE_BUSY, std::memory_order_acquire)) {
+        entry.row = row;
+        entry.key.store(pc, std::memory_order_release);
+    }
+    return row.cfa_slot != 0xff;
+}
+
+static uintptr_t strip_pac(uintptr_t pc) {
+#if defined(__aarch64__)
+    return pc & 0x0000ffffffffffffULL;
+#else
+    return pc;
+#endif
+}
+
+// True if [addr, addr + size) is on the stack being unwound
+static bool on_stack(const UnwindContext &ctx, uintptr_t addr, size_t size) {
+    return addr >= ctx.stack.lo && addr < ctx.stack.hi && ctx.stack.hi - addr >= size;
+}
+
+static bool step_frame_pointer(UnwindContext &ctx) {
+    uintptr_t sp = ctx.regs[REG_SLOT_SP];
+    uintptr_t fp = ctx.regs[REG_SLOT_FP];
+    if (!on_stack(ctx, sp, 0) || fp < sp || !on_stack(ctx, fp, 2 * sizeof(uintptr_t)) ||
+        (fp & (sizeof(uintptr_t) - 1))) {
+        return false;
+    }
+
+    auto frame = reinterpret_cast<const uintptr_t *>(fp);
+    ctx.regs[REG_SLOT_FP] = frame[0];
+    ctx.pc = strip_pac(frame[1]);
+    ctx.regs[REG_SLOT_SP] = fp + 2 * sizeof(uintptr_t);
+    return true;
+}
+
+static bool step_cfi(UnwindContext &ctx, const UnwindRow &row) {
+    uintptr_t sp = ctx.regs[REG_SLOT_SP];
+    uintptr_t cfa = ctx.regs[row.cfa_slot] + row.cfa_offset;
+    if (!on_stack(ctx, sp, 0) || cfa < sp || !on_stack(ctx, cfa, 0) || (cfa & (sizeof(uintptr_t) - 1))) return false;
+
+    uintptr_t regs[REG_SLOTS];
+    for (int i = 0; i < REG_SLOTS; i++) {
+        switch (row.kind[i]) {
+            case RULE_SAME:
+                regs[i] = ctx.regs[i];
+                break;
+            case RULE_UNDEFINED:
+                regs[i] = 0;
+                break;
+            case RULE_OFFSET: {
+                uintptr_t addr = cfa + row.value[i];
+                // saved registers always live between the current sp and the CFA
+                if (addr < sp || addr + sizeof(uintptr_t) > cfa) return false;
+                regs[i] = *reinterpret_cast<const uintptr_t *>(addr);
+                break;
+            }
+            case RULE_VAL_OFFSET:
+                regs[i] = cfa + row.value[i];
+                break;
+            case RULE_REGISTER:
+                regs[i] = ctx.regs[row.value[i]];
+                break;
+        }
+    }
+
+    int ra_slot = dwarf_to_slot(DWARF_RA_REG);
+    if (row.kind[ra_slot] == RULE_UNDEFINED) return false;  // outermost frame
+    ctx.pc = strip_pac(regs[ra_slot]);
+    memcpy(ctx.regs, regs, sizeof(regs));
+    ctx.regs[REG_SLOT_SP] = cfa;
+    return true;
+}
+
+static size_t unwind_context(UnwindContext &ctx, uintptr_t *pcs, size_t max_frames, bool exact_pc) {
+    size_t frames = 0;
+    while (frames < max_frames && ctx.pc != 0) {
+        pcs[frames++] = ctx.pc;
+
+        // return addresses point after the call, look up the call instruction instead
+        uintptr_t lookup_pc = exact_pc ? ctx.pc : ctx.pc - 1;
+        exact_pc = false;
+
+        UnwindRow row;
+        uintptr_t prev_sp = ctx.regs[REG_SLOT_SP];
+        uintptr_t prev_pc = ctx.pc;
+        bool stepped = lookup_row(lookup_pc, row) ? step_cfi(ctx, row) : step_frame_pointer(ctx);
+        if (!stepped) break;
+        if (ctx.regs[REG_SLOT_SP] == prev_sp && ctx.pc == prev_pc) break;
+    }
+    return frames;
+}
+
+static int refresh_modules_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void) size;
+    auto table = static_cast<ModuleTable *>(arg);
+    if (table->count == UNWIND_MAX_MODULES) return 1;
+
+    UnwindModule module{UINTPTR_MAX, 0, 0};
+    for (size_t i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+            module.start = std::min<uintptr_t>(module.start, info->dlpi_addr + phdr->p_vaddr);
+            module.end = std::max<uintptr_t>(module.end, info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz);
+        } else if (phdr->p_type == PT_GNU_EH_FRAME) {
+            module.eh_frame_hdr = info->dlpi_addr + phdr->p_vaddr;
+        }
+    }
+    if (module.start < module.end) table->modules[table->count++] = module;
+    return 0;
+}
+
+void unwind_refresh_modules() {
+    pthread_mutex_lock(&refresh_lock);
+    ModuleTable *table = active_modules.load(std::memory_order_relaxed) == &module_tables[0]
+                         ? &module_tables[1] : &module_tables[0];
+    table->count = 0;
+    xdl_iterate_phdr(refresh_modules_cb, table, XDL_DEFAULT);
+    std::sort(table->modules, table->modules + table->count,
+              [](const UnwindModule &a, const UnwindModule &b) { return a.start < b.start; });
+    active_modules.store(table, std::memory_order_release);
+
+    // rows keyed by pc are stale once a range may belong to a different library
+    for (auto &entry : row_cache) entry.key.store(0, std::memory_order_relaxed);
+    pthread_mutex_unlock(&refresh_lock);
+}
+
+bool unwind_current_stack(UnwindStack *stack) {
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) return false;
+    void *addr = nullptr;
+    size_t size = 0;
+    bool ok = pthread_attr_getstack(&attr, &addr, &size) == 0;
+    pthread_attr_destroy(&attr);
+    if (!ok) return false;
+    stack->lo = (uintptr_t) addr;
+    stack->hi = stack->lo + size;
+    return true;
+}
+
+uintptr_t unwind_stack_pointer(const void *ucontext) {
+    auto uc = static_cast<const ucontext_t *>(ucontext);
+#if defined(__aarch64__)
+    return uc->uc_mcontext.sp;
+#else
+    return uc->uc_mcontext.gregs[REG_RSP];
+#endif
+}
+
+[[gnu::noinline]] size_t unwind_backtrace(uintptr_t *pcs, size_t max_frames) {
+    if (pcs == nullptr || max_frames == 0) return 0;
+    if (active_modules.load(std::memory_order_acquire) == nullptr) unwind_refresh_modules();
+
+    UnwindContext ctx{};
+    if (!unwind_current_stack(&ctx.stack)) return 0;
+#if defined(__aarch64__)
+    __asm__ volatile(
+            "stp x19, x20, [%1, #0]\n"
+            "stp x21, x22, [%1, #16]\n"
+            "stp x23, x24, [%1, #32]\n"
+            "stp x25, x26, [%1, #48]\n"
+            "stp x27, x28, [%1, #64]\n"
+            "stp x29, x30, [%1, #80]\n"
+            "mov x9, sp\n"
+            "str x9, [%1, #96]\n"
+            "adr x9, .\n"
+            "str x9, %0\n"
+            : "=m"(ctx.pc) : "r"(ctx.regs) : "x9", "memory");
+#else
+    __asm__ volatile(
+            "movq %%rbx, 0(%1)\n"
+            "movq %%rbp, 8(%1)\n"
+            "movq %%rsp, 16(%1)\n"
+            "movq %%r12, 24(%1)\n"
+            "movq %%r13, 32(%1)\n"
+            "movq %%r14, 40(%1)\n"
+            "movq %%r15, 48(%1)\n"
+            "leaq 0(%%rip), %%rax\n"
+            "movq %%rax, %0\n"
+            : "=m"(ctx.pc) : "r"(ctx.regs) : "rax", "memory");
+#endif
+
+    // the first frame is unwind_backtrace() itself
+    uintptr_t frames[UNWIND_MAX_FRAMES + 1];
+    size_t count = unwind_context(ctx, frames, std::min<size_t>(max_frames + 1, UNWIND_MAX_FRAMES + 1), true);
+    if (count <= 1) return 0;
+    memcpy(pcs, frames + 1, (count - 1) * sizeof(uintptr_t));
+    return count - 1;
+}
+
+size_t unwind_from_ucontext(const void *ucontext, const UnwindStack &stack, uintptr_t *pcs, size_t max_frames) {
+    if (ucontext == nullptr || pcs == nullptr || max_frames == 0) return 0;
+
+    auto uc = static_cast<const ucontext_t *>(ucontext);
+    UnwindContext ctx{};
+    ctx.stack = stack;
+#if defined(__aarch64__)
+    for (int i = 0; i < 12; i++) ctx.regs[i] = uc->uc_mcontext.regs[19 + i];
+    ctx.regs[REG_SLOT_SP] = uc->uc_mcontext.sp;
+    ctx.pc = uc->uc_mcontext.pc;
+#else
+    ctx.regs[0] = uc->uc_mcontext.gregs[REG_RBX];
+    ctx.regs[1] = uc->uc_mcontext.gregs[REG_RBP];
+    ctx.regs[2] = uc->uc_mcontext.gregs[REG_RSP];
+    ctx.regs[3] = uc->uc_mcontext.gregs[REG_R12];
+    ctx.regs[4] = uc->uc_mcontext.gregs[REG_R13];
+    ctx.regs[5] = uc->uc_mcontext.gregs[REG_R14];
+    ctx.regs[6] = uc->uc_mcontext.gregs[REG_R15];
+    ctx.pc = uc->uc_mcontext.gregs[REG_RIP];
+#endif
+    return unwind_context(ctx, pcs, max_frames, true);
+}
+
+#else
+
+size_t unwind_backtrace(uintptr_t *pcs, size_t max_frames) {
+    (void) pcs;
+    (void) max_frames;
+    return 0;
+}
+
+bool unwind_current_stack(UnwindStack *stack) {
+    (void) stack;
+    return false;
+}
+
+uintptr_t unwind_stack_pointer(const void *ucontext) {
+    (void) ucontext;
+    return 0;
+}
+
+size_t unwind_from_ucontext(const void *ucontext, const UnwindStack &stack, uintptr_t *pcs, size_t max_frames) {
+    (void) ucontext;
+    (void) stack;
+    (void) pcs;
+    (void) max_frames;
+    return 0;
+}
+
+void unwind_refresh_modules() {}
+
+#endif
@@ -67,6 +67,14 @@ void *xdl_close(void *handle);
 void *xdl_sym(void *handle, const char *symbol, size_t *symbol_size);
 void *xdl_dsym(void *handle, const char *symbol, size_t *symbol_size);
 
+//
+// Load an ELF from a file descriptor or a memory buffer (ANDROID_DLEXT_USE_LIBRARY_FD).
+// With XDL_TRY_FORCE_LOAD / XDL_ALWAYS_FORCE_LOAD the linker-internal dlopen is tried first, like
+// xdl_open(), then android_dlopen_ext(); dlopen("/proc/self/fd/N") is the last fallback.
+//
+void *xdl_open_fd(int fd, int flags);
+void *xdl_open_memory(const void *buf, size_t len, int flags);
+
 //
 // Enhanced dladdr().
 //
@@ -79,6 +87,26 @@ void xdl_addr_clean(void **cache);
 #define XDL_FULL_PATHNAME 0x01
 int xdl_iterate_phdr(int (*callback)(struct dl_phdr_info *, size_t, void *), void *data, int flags);
 
+//
+// Library-load notification.
+// Callbacks run on a dedicated thread, never under the linker lock. Loads are detected by polling
+// the linker's load generation, so an event arrives a few milliseconds after dlopen() returns.
+// With XDL_ON_LOAD_REPLAY the modules loaded before the subscription are reported to cb as well.
+// Once xdl_on_load_cancel() returns, cb is not running and is not called again, so arg may be
+// freed. It waits for a callback in progress, so it must not be called holding a lock callbacks
+// take; from within a callback it returns at once.
+//
+typedef struct {
+  const char *name;             // Pathname of the loaded ELF, valid during the callback only.
+  uintptr_t load_bias;          // Same as dl_phdr_info.dlpi_addr.
+  const ElfW(Phdr) *dlpi_phdr;  // Pointer to array of ELF program headers for this object.
+  size_t dlpi_phnum;            // Number of items in dlpi_phdr.
+} xdl_load_event_t;
+typedef void (*xdl_on_load_cb_t)(const xdl_load_event_t *event, void *arg);
+#define XDL_ON_LOAD_REPLAY 0x01
+int xdl_on_load(xdl_on_load_cb_t cb, void *arg, int flags);
+int xdl_on_load_cancel(xdl_on_load_cb_t cb, void *arg);
+
 //
 // Custom dlinfo().
 //
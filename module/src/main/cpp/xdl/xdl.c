@@ -24,11 +24,14 @@
 #include "xdl.h"
 
 #include <android/api-level.h>
+#include <android/dlext.h>
 #include <elf.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <link.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -38,6 +41,7 @@
 #include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -56,7 +60,13 @@
 #define XDL_SYMTAB_IS_EXPORT_SYM(shndx) \
   (SHN_UNDEF != (shndx) && !((shndx) >= SHN_LORESERVE && (shndx) <= SHN_HIRESERVE))
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 extern __attribute((weak)) unsigned long int getauxval(unsigned long int);
+extern __attribute((weak)) void *android_dlopen_ext(const char *, int, const android_dlextinfo *);
+extern __attribute((weak)) int dl_iterate_phdr(int (*)(struct dl_phdr_info *, size_t, void *), void *);
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wpadded"
@@ -540,6 +550,77 @@ void *xdl_open(const char *filename, int flags) {
     return xdl_find(filename);
 }
 
+void *xdl_open_fd(int fd, int flags) {
+  if (fd < 0) return NULL;
+
+  // the linker names an ELF loaded from fd after the realpath of the fd
+  char fd_path[64];
+  char pathname[PATH_MAX];
+  snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+  ssize_t len = readlink(fd_path, pathname, sizeof(pathname) - 1);
+  if (len <= 0) return NULL;
+  pathname[len] = '\0';
+
+  android_dlextinfo extinfo;
+  memset(&extinfo, 0, sizeof(extinfo));
+  extinfo.flags = ANDROID_DLEXT_USE_LIBRARY_FD;
+  extinfo.library_fd = fd;
+
+  // force load first (caller namespace bypassed), then the public dlext as the caller
+  void *linker_handle = NULL;
+  if (flags & (XDL_TRY_FORCE_LOAD | XDL_ALWAYS_FORCE_LOAD))
+    linker_handle = xdl_linker_force_dlopen_ext(pathname, &extinfo);
+  if (NULL == linker_handle && NULL != android_dlopen_ext)
+    linker_handle = android_dlopen_ext(pathname, RTLD_NOW, &extinfo);
+
+  // last resort, and the only way without dlext (plain Linux): let the loader open the fd through
+  // procfs
+  bool by_fd_path = false;
+  if (NULL == linker_handle) {
+    if (NULL == (linker_handle = dlopen(fd_path, RTLD_NOW))) return NULL;
+    by_fd_path = true;
+  }
+
+  // find (bionic reports the realpath, glibc the name given to dlopen)
+  xdl_t *self = xdl_find(by_fd_path ? fd_path : pathname);
+  if (NULL == self && by_fd_path) self = xdl_find(pathname);
+  if (NULL == self)
+    dlclose(linker_handle);
+  else
+    self->linker_handle = linker_handle;
+
+  return (void *)self;
+}
+
+void *xdl_open_memory(const void *buf, size_t len, int flags) {
+  if (NULL == buf || 0 == len) return NULL;
+
+  // a unique name per buffer, so xdl_find() cannot pick up an earlier one
+  static uint32_t seq = 0;
+  char name[32];
+  snprintf(name, sizeof(name), "xdl-%" PRIu32, __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+
+  int fd = (int)syscall(__NR_memfd_create, name, MFD_CLOEXEC);
+  if (fd < 0) return NULL;
+
+  size_t offset = 0;
+  while (offset < len) {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wgnu-statement-expression"
+    ssize_t n = XDL_UTIL_TEMP_FAILURE_RETRY(write(fd, (const uint8_t *)buf + offset, len - offset));
+#pragma clang diagnostic pop
+    if (n <= 0) {
+      close(fd);
+      return NULL;
+    }
+    offset += (size_t)n;
+  }
+
+  void *handle = xdl_open_fd(fd, flags);
+  close(fd);  // the mappings keep the memfd alive
+  return handle;
+}
+
 void *xdl_close(void *handle) {
   if (NULL == handle) return NULL;
 
@@ -908,3 +989,399 @@ int xdl_info(void *handle, int request, void *info) {
   dlinfo->dlpi_phnum = (size_t)self->dlpi_phnum;
   return 0;
 }
+
+//
+// Library-load notification.
+//
+// The linker reports every load to debuggers through rtld_db_dlactivity(), but it calls that
+// function directly instead of through _r_debug.r_brk, so it can only be intercepted with an
+// inline hook. Loads are detected by polling the linker's load generation instead:
+// dl_iterate_phdr() exposes it as dlpi_adds (Android 11+), older linkers fall back to a
+// signature of the loaded modules. Only when the generation changes the module list is
+// snapshotted and diffed against the previous one. New modules are handed to the dispatcher
+// thread through a lock-free SPSC ring, so callbacks never run under the linker lock.
+//
+
+#define XDL_ON_LOAD_MAX_SUBSCRIBERS 8
+#define XDL_ON_LOAD_RING_CAP        64  // must be a power of two
+#define XDL_ON_LOAD_NAME_MAX        512
+#define XDL_ON_LOAD_POLL_US         2000
+
+typedef struct {
+  uintptr_t load_bias;
+  const ElfW(Phdr) *dlpi_phdr;
+  size_t dlpi_phnum;
+  char *name;
+} xdl_on_load_module_t;
+
+typedef struct {
+  xdl_on_load_module_t *modules;  // sorted by load_bias
+  size_t count;
+  size_t cap;
+} xdl_on_load_snapshot_t;
+
+typedef struct {
+  xdl_on_load_cb_t cb;
+  void *arg;
+  bool replay_pending;
+} xdl_on_load_subscriber_t;
+
+typedef struct {
+  uintptr_t load_bias;
+  const ElfW(Phdr) *dlpi_phdr;
+  size_t dlpi_phnum;
+  char name[XDL_ON_LOAD_NAME_MAX];
+} xdl_on_load_slot_t;
+
+static pthread_mutex_t xdl_on_load_lock = PTHREAD_MUTEX_INITIALIZER;
+static xdl_on_load_subscriber_t xdl_on_load_subscribers[XDL_ON_LOAD_MAX_SUBSCRIBERS];
+static size_t xdl_on_load_subscribers_count = 0;
+static bool xdl_on_load_poller_running = false;
+static bool xdl_on_load_dispatcher_running = false;
+static sem_t xdl_on_load_sem;
+
+// xdl_on_load_cancel() waits on the batch generation until a batch in flight has ended, so the
+// canceled callback is not running and will not run once it returns
+static pthread_cond_t xdl_on_load_batch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t xdl_on_load_dispatcher_thread;
+static uint64_t xdl_on_load_batch_gen = 0;
+static bool xdl_on_load_batch_running = false;
+static uint32_t xdl_on_load_cancels = 0;  // tells a running batch to drop canceled subscribers
+
+// single producer (poller thread), single consumer (dispatcher thread)
+static xdl_on_load_slot_t xdl_on_load_ring[XDL_ON_LOAD_RING_CAP];
+static uint32_t xdl_on_load_ring_head = 0;
+static uint32_t xdl_on_load_ring_tail = 0;
+
+typedef struct {
+  unsigned long long adds;
+  uintptr_t signature;
+  size_t count;
+  bool has_adds;
+} xdl_on_load_gen_t;
+
+// the poller starts from a generation read before its baseline, so a load in between is noticed
+typedef struct {
+  xdl_on_load_gen_t gen;
+  xdl_on_load_snapshot_t snapshot;
+} xdl_on_load_baseline_t;
+
+static int xdl_on_load_gen_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+  xdl_on_load_gen_t *gen = (xdl_on_load_gen_t *)arg;
+
+  if (size >= offsetof(struct dl_phdr_info, dlpi_adds) + sizeof(info->dlpi_adds)) {
+    gen->adds = info->dlpi_adds;
+    gen->has_adds = true;
+    return 1;  // the counter is the same in every entry
+  }
+
+  gen->signature = gen->signature * 31 + (uintptr_t)info->dlpi_addr + (uintptr_t)info->dlpi_phdr;
+  gen->count++;
+  return 0;
+}
+
+static bool xdl_on_load_gen_equal(xdl_on_load_gen_t *a, xdl_on_load_gen_t *b) {
+  if (a->has_adds != b->has_adds) return false;
+  if (a->has_adds) return a->adds == b->adds;
+  return a->signature == b->signature && a->count == b->count;
+}
+
+static void xdl_on_load_gen_get(xdl_on_load_gen_t *gen) {
+  memset(gen, 0, sizeof(xdl_on_load_gen_t));
+  if (NULL != dl_iterate_phdr) dl_iterate_phdr(xdl_on_load_gen_cb, gen);
+}
+
+static void xdl_on_load_snapshot_clean(xdl_on_load_snapshot_t *snapshot) {
+  for (size_t i = 0; i < snapshot->count; i++) free(snapshot->modules[i].name);
+  free(snapshot->modules);
+  memset(snapshot, 0, sizeof(xdl_on_load_snapshot_t));
+}
+
+static int xdl_on_load_snapshot_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+  (void)size;
+
+  xdl_on_load_snapshot_t *snapshot = (xdl_on_load_snapshot_t *)arg;
+  if (snapshot->count == snapshot->cap) {
+    size_t cap = (0 == snapshot->cap ? 256 : snapshot->cap * 2);
+    xdl_on_load_module_t *modules = realloc(snapshot->modules, cap * sizeof(xdl_on_load_module_t));
+    if (NULL == modules) return 1;
+    snapshot->modules = modules;
+    snapshot->cap = cap;
+  }
+
+  char *name = strdup(NULL == info->dlpi_name ? "" : info->dlpi_name);
+  if (NULL == name) return 1;
+
+  xdl_on_load_module_t *module = &snapshot->modules[snapshot->count++];
+  module->load_bias = (uintptr_t)info->dlpi_addr;
+  module->dlpi_phdr = info->dlpi_phdr;
+  module->dlpi_phnum = (size_t)info->dlpi_phnum;
+  module->name = name;
+  return 0;
+}
+
+static int xdl_on_load_module_cmp(const void *a, const void *b) {
+  const xdl_on_load_module_t *ma = (const xdl_on_load_module_t *)a;
+  const xdl_on_load_module_t *mb = (const xdl_on_load_module_t *)b;
+  if (ma->load_bias != mb->load_bias) return ma->load_bias < mb->load_bias ? -1 : 1;
+  if (ma->dlpi_phdr != mb->dlpi_phdr) return (uintptr_t)ma->dlpi_phdr < (uintptr_t)mb->dlpi_phdr ? -1 : 1;
+  return 0;
+}
+
+static void xdl_on_load_snapshot_take(xdl_on_load_snapshot_t *snapshot) {
+  memset(snapshot, 0, sizeof(xdl_on_load_snapshot_t));
+  xdl_iterate_phdr_impl(xdl_on_load_snapshot_cb, snapshot, XDL_FULL_PATHNAME);
+  if (snapshot->count > 1)
+    qsort(snapshot->modules, snapshot->count, sizeof(xdl_on_load_module_t), xdl_on_load_module_cmp);
+}
+
+static bool xdl_on_load_ring_push(xdl_on_load_module_t *module) {
+  uint32_t head = __atomic_load_n(&xdl_on_load_ring_head, __ATOMIC_RELAXED);
+  uint32_t tail = __atomic_load_n(&xdl_on_load_ring_tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= XDL_ON_LOAD_RING_CAP) return false;
+
+  xdl_on_load_slot_t *slot = &xdl_on_load_ring[head & (XDL_ON_LOAD_RING_CAP - 1)];
+  slot->load_bias = module->load_bias;
+  slot->dlpi_phdr = module->dlpi_phdr;
+  slot->dlpi_phnum = module->dlpi_phnum;
+  strlcpy(slot->name, module->name, sizeof(slot->name));
+  __atomic_store_n(&xdl_on_load_ring_head, head + 1, __ATOMIC_RELEASE);
+  sem_post(&xdl_on_load_sem);
+  return true;
+}
+
+// Pushes the modules of cur that are not in prev. Returns false if the ring was full, the modules
+// that did not fit are removed from cur so that the next diff reports them again.
+static bool xdl_on_load_diff(xdl_on_load_snapshot_t *prev, xdl_on_load_snapshot_t *cur) {
+  bool complete = true;
+  size_t i = 0, kept = 0;
+
+  for (size_t j = 0; j < cur->count; j++) {
+    xdl_on_load_module_t *module = &cur->modules[j];
+    while (i < prev->count && xdl_on_load_module_cmp(&prev->modules[i], module) < 0) i++;
+    bool known = (i < prev->count && 0 == xdl_on_load_module_cmp(&prev->modules[i], module));
+
+    if (!known && (!complete || !xdl_on_load_ring_push(module))) {
+      complete = false;
+      free(module->name);
+      continue;
+    }
+    cur->modules[kept++] = *module;
+  }
+  cur->count = kept;
+  return complete;
+}
+
+static void *xdl_on_load_poller(void *arg) {
+  xdl_on_load_baseline_t *baseline = (xdl_on_load_baseline_t *)arg;
+  xdl_on_load_snapshot_t *prev = &baseline->snapshot;
+  xdl_on_load_gen_t last_gen = baseline->gen, gen;
+  bool pending = false;
+
+  pthread_setname_np(pthread_self(), "xdl-on-load");
+
+  while (1) {
+    pthread_mutex_lock(&xdl_on_load_lock);
+    if (0 == xdl_on_load_subscribers_count) {
+      xdl_on_load_poller_running = false;
+      pthread_mutex_unlock(&xdl_on_load_lock);
+      break;
+    }
+    pthread_mutex_unlock(&xdl_on_load_lock);
+
+    usleep(XDL_ON_LOAD_POLL_US);
+
+    xdl_on_load_gen_get(&gen);
+    if (!pending && xdl_on_load_gen_equal(&gen, &last_gen)) continue;
+    last_gen = gen;
+
+    xdl_on_load_snapshot_t cur;
+    xdl_on_load_snapshot_take(&cur);
+    pending = !xdl_on_load_diff(prev, &cur);
+    xdl_on_load_snapshot_clean(prev);
+    *prev = cur;
+  }
+
+  xdl_on_load_snapshot_clean(prev);
+  free(baseline);
+  return NULL;
+}
+
+static void xdl_on_load_call(xdl_on_load_subscriber_t *subscribers, size_t count,
+                             const xdl_load_event_t *event) {
+  for (size_t i = 0; i < count; i++) subscribers[i].cb(event, subscribers[i].arg);
+}
+
+static size_t xdl_on_load_copy_subscribers(xdl_on_load_subscriber_t *subscribers,
+                                           xdl_on_load_subscriber_t *replays, size_t *replays_count,
+                                           uint32_t *cancels) {
+  pthread_mutex_lock(&xdl_on_load_lock);
+  xdl_on_load_batch_running = true;
+  *cancels = __atomic_load_n(&xdl_on_load_cancels, __ATOMIC_RELAXED);
+  size_t count = xdl_on_load_subscribers_count;
+  memcpy(subscribers, xdl_on_load_subscribers, count * sizeof(xdl_on_load_subscriber_t));
+  *replays_count = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (xdl_on_load_subscribers[i].replay_pending) {
+      xdl_on_load_subscribers[i].replay_pending = false;
+      replays[(*replays_count)++] = xdl_on_load_subscribers[i];
+    }
+  }
+  pthread_mutex_unlock(&xdl_on_load_lock);
+  return count;
+}
+
+static bool xdl_on_load_subscribed(const xdl_on_load_subscriber_t *subscriber) {
+  for (size_t i = 0; i < xdl_on_load_subscribers_count; i++) {
+    if (xdl_on_load_subscribers[i].cb == subscriber->cb && xdl_on_load_subscribers[i].arg == subscriber->arg)
+      return true;
+  }
+  return false;
+}
+
+static size_t xdl_on_load_drop_canceled(xdl_on_load_subscriber_t *subscribers, size_t count) {
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (xdl_on_load_subscribed(&subscribers[i])) subscribers[kept++] = subscribers[i];
+  }
+  return kept;
+}
+
+// a callback canceled itself or another subscriber while this batch runs
+static void xdl_on_load_check_canceled(uint32_t *cancels, xdl_on_load_subscriber_t *subscribers,
+                                       size_t *count, xdl_on_load_subscriber_t *replays,
+                                       size_t *replays_count) {
+  if (__atomic_load_n(&xdl_on_load_cancels, __ATOMIC_RELAXED) == *cancels) return;
+  pthread_mutex_lock(&xdl_on_load_lock);
+  *cancels = xdl_on_load_cancels;
+  *count = xdl_on_load_drop_canceled(subscribers, *count);
+  *replays_count = xdl_on_load_drop_canceled(replays, *replays_count);
+  pthread_mutex_unlock(&xdl_on_load_lock);
+}
+
+static void xdl_on_load_end_batch(void) {
+  pthread_mutex_lock(&xdl_on_load_lock);
+  xdl_on_load_batch_running = false;
+  xdl_on_load_batch_gen++;
+  pthread_cond_broadcast(&xdl_on_load_batch_cond);
+  pthread_mutex_unlock(&xdl_on_load_lock);
+}
+
+static void *xdl_on_load_dispatcher(void *arg) {
+  (void)arg;
+  xdl_on_load_subscriber_t subscribers[XDL_ON_LOAD_MAX_SUBSCRIBERS];
+  xdl_on_load_subscriber_t replays[XDL_ON_LOAD_MAX_SUBSCRIBERS];
+  size_t replays_count;
+  uint32_t cancels;
+  xdl_load_event_t event;
+
+  pthread_setname_np(pthread_self(), "xdl-dispatch");
+
+  while (1) {
+    XDL_UTIL_TEMP_FAILURE_RETRY(sem_wait(&xdl_on_load_sem));
+    size_t count = xdl_on_load_copy_subscribers(subscribers, replays, &replays_count, &cancels);
+
+    // report the modules that were loaded before the subscription
+    if (replays_count > 0) {
+      xdl_on_load_snapshot_t snapshot;
+      xdl_on_load_snapshot_take(&snapshot);
+      for (size_t i = 0; i < snapshot.count; i++) {
+        event.name = snapshot.modules[i].name;
+        event.load_bias = snapshot.modules[i].load_bias;
+        event.dlpi_phdr = snapshot.modules[i].dlpi_phdr;
+        event.dlpi_phnum = snapshot.modules[i].dlpi_phnum;
+        xdl_on_load_check_canceled(&cancels, subscribers, &count, replays, &replays_count);
+        xdl_on_load_call(replays, replays_count, &event);
+      }
+      xdl_on_load_snapshot_clean(&snapshot);
+    }
+
+    uint32_t tail = __atomic_load_n(&xdl_on_load_ring_tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&xdl_on_load_ring_head, __ATOMIC_ACQUIRE);
+    for (; tail != head; tail++) {
+      xdl_on_load_slot_t *slot = &xdl_on_load_ring[tail & (XDL_ON_LOAD_RING_CAP - 1)];
+      event.name = slot->name;
+      event.load_bias = slot->load_bias;
+      event.dlpi_phdr = slot->dlpi_phdr;
+      event.dlpi_phnum = slot->dlpi_phnum;
+      xdl_on_load_check_canceled(&cancels, subscribers, &count, replays, &replays_count);
+      xdl_on_load_call(subscribers, count, &event);
+      __atomic_store_n(&xdl_on_load_ring_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    xdl_on_load_end_batch();
+  }
+  return NULL;
+}
+
+static int xdl_on_load_start_threads(void) {
+  pthread_t thread;
+
+  if (!xdl_on_load_dispatcher_running) {
+    if (0 != sem_init(&xdl_on_load_sem, 0, 0)) return -1;
+    if (0 != pthread_create(&thread, NULL, xdl_on_load_dispatcher, NULL)) {
+      sem_destroy(&xdl_on_load_sem);
+      return -1;
+    }
+    pthread_detach(thread);
+    xdl_on_load_dispatcher_thread = thread;
+    xdl_on_load_dispatcher_running = true;
+  }
+
+  if (!xdl_on_load_poller_running) {
+    // the baseline is taken before returning, so no load after xdl_on_load() is missed
+    xdl_on_load_baseline_t *baseline = malloc(sizeof(xdl_on_load_baseline_t));
+    if (NULL == baseline) return -1;
+    xdl_on_load_gen_get(&baseline->gen);
+    xdl_on_load_snapshot_take(&baseline->snapshot);
+    if (0 != pthread_create(&thread, NULL, xdl_on_load_poller, baseline)) {
+      xdl_on_load_snapshot_clean(&baseline->snapshot);
+      free(baseline);
+      return -1;
+    }
+    pthread_detach(thread);
+    xdl_on_load_poller_running = true;
+  }
+  return 0;
+}
+
+int xdl_on_load(xdl_on_load_cb_t cb, void *arg, int flags) {
+  if (NULL == cb) return -1;
+
+  int r = -1;
+  pthread_mutex_lock(&xdl_on_load_lock);
+  if (xdl_on_load_subscribers_count >= XDL_ON_LOAD_MAX_SUBSCRIBERS) goto end;
+  if (0 != xdl_on_load_start_threads()) goto end;
+
+  xdl_on_load_subscriber_t *subscriber = &xdl_on_load_subscribers[xdl_on_load_subscribers_count++];
+  subscriber->cb = cb;
+  subscriber->arg = arg;
+  subscriber->replay_pending = (0 != (flags & XDL_ON_LOAD_REPLAY));
+  if (subscriber->replay_pending) sem_post(&xdl_on_load_sem);
+  r = 0;
+
+end:
+  pthread_mutex_unlock(&xdl_on_load_lock);
+  return r;
+}
+
+int xdl_on_load_cancel(xdl_on_load_cb_t cb, void *arg) {
+  int r = -1;
+  pthread_mutex_lock(&xdl_on_load_lock);
+  for (size_t i = 0; i < xdl_on_load_subscribers_count; i++) {
+    if (xdl_on_load_subscribers[i].cb == cb && xdl_on_load_subscribers[i].arg == arg) {
+      xdl_on_load_subscribers[i] = xdl_on_load_subscribers[--xdl_on_load_subscribers_count];
+      __atomic_add_fetch(&xdl_on_load_cancels, 1, __ATOMIC_RELAXED);
+      r = 0;
+      break;
+    }
+  }
+  // the batch in flight may still call cb; from a callback the batch drops cb itself instead
+  if (0 == r && xdl_on_load_dispatcher_running &&
+      !pthread_equal(pthread_self(), xdl_on_load_dispatcher_thread)) {
+    uint64_t gen = xdl_on_load_batch_gen;
+    while (xdl_on_load_batch_running && gen == xdl_on_load_batch_gen)
+      pthread_cond_wait(&xdl_on_load_batch_cond, &xdl_on_load_lock);
+  }
+  pthread_mutex_unlock(&xdl_on_load_lock);
+  return r;
+}
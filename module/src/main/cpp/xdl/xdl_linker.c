@@ -23,6 +23,7 @@
 
 #include "xdl_linker.h"
 
+#include <android/dlext.h>
 #include <dlfcn.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -37,12 +38,17 @@
 #define XDL_LINKER_SYM_DO_DLOPEN_N     "__dl__Z9do_dlopenPKciPK17android_dlextinfoPv"
 #define XDL_LINKER_SYM_DLOPEN_O        "__dl__Z8__dlopenPKciPKv"
 #define XDL_LINKER_SYM_LOADER_DLOPEN_P "__loader_dlopen"
+#define XDL_LINKER_SYM_DLOPEN_EXT_O    "__dl__Z20__android_dlopen_extPKciPK17android_dlextinfoPKv"
+#define XDL_LINKER_SYM_LOADER_DLOPEN_EXT_P "__loader_android_dlopen_ext"
+
+extern __attribute((weak)) void *android_dlopen_ext(const char *, int, const android_dlextinfo *);
 
 typedef void *(*xdl_linker_dlopen_n_t)(const char *, int, const void *, void *);
 typedef void *(*xdl_linker_dlopen_o_t)(const char *, int, const void *);
 
 static pthread_mutex_t *xdl_linker_mutex = NULL;
 static void *xdl_linker_dlopen = NULL;
+static void *xdl_linker_dlopen_ext = NULL;
 
 static void *xdl_linker_caller_addr[] = {
     NULL,  // default
@@ -77,12 +83,16 @@ static void xdl_linker_init_symbols_impl(void) {
       xdl_linker_dlopen = xdl_dsym(handle, XDL_LINKER_SYM_DO_DLOPEN_N, NULL);
       xdl_linker_mutex = (pthread_mutex_t *)xdl_dsym(handle, XDL_LINKER_SYM_MUTEX, NULL);
     }
+    // both take extinfo
+    xdl_linker_dlopen_ext = xdl_linker_dlopen;
   } else if (__ANDROID_API_O__ == api_level || __ANDROID_API_O_MR1__ == api_level) {
     // == Android 8.x
     xdl_linker_dlopen = xdl_dsym(handle, XDL_LINKER_SYM_DLOPEN_O, NULL);
+    xdl_linker_dlopen_ext = xdl_dsym(handle, XDL_LINKER_SYM_DLOPEN_EXT_O, NULL);
   } else if (api_level >= __ANDROID_API_P__) {
     // >= Android 9.0
     xdl_linker_dlopen = xdl_sym(handle, XDL_LINKER_SYM_LOADER_DLOPEN_P, NULL);
+    xdl_linker_dlopen_ext = xdl_sym(handle, XDL_LINKER_SYM_LOADER_DLOPEN_EXT_P, NULL);
   }
 
   xdl_close(handle);
@@ -206,3 +216,32 @@ void *xdl_linker_force_dlopen(const char *filename) {
     return handle;
   }
 }
+
+void *xdl_linker_force_dlopen_ext(const char *filename, const void *extinfo) {
+  int api_level = xdl_util_get_api_level();
+
+  if (api_level <= __ANDROID_API_M__) {
+    // <= Android 6.0
+    if (NULL == android_dlopen_ext) return NULL;  // API level < 21
+    return android_dlopen_ext(filename, RTLD_NOW, (const android_dlextinfo *)extinfo);
+  } else {
+    xdl_linker_init_symbols();
+    if (NULL == xdl_linker_dlopen_ext) return NULL;
+    xdl_linker_init_caller_addr();
+
+    // dlopen_ext (7.x), __android_dlopen_ext (8.x) and __loader_android_dlopen_ext (>= 9.0)
+    // share the same prototype
+    bool need_lock = (__ANDROID_API_N__ == api_level || __ANDROID_API_N_MR1__ == api_level);
+    void *handle = NULL;
+    if (need_lock) xdl_linker_lock();
+    for (size_t i = 0; i < sizeof(xdl_linker_caller_addr) / sizeof(xdl_linker_caller_addr[0]); i++) {
+      if (NULL != xdl_linker_caller_addr[i]) {
+        handle = ((xdl_linker_dlopen_n_t)xdl_linker_dlopen_ext)(filename, RTLD_NOW, extinfo,
+                                                               xdl_linker_caller_addr[i]);
+        if (NULL != handle) break;
+      }
+    }
+    if (need_lock) xdl_linker_unlock();
+    return handle;
+  }
+}
@@ -32,6 +32,7 @@ void xdl_linker_lock(void);
 void xdl_linker_unlock(void);
 
 void *xdl_linker_force_dlopen(const char *filename);
+void *xdl_linker_force_dlopen_ext(const char *filename, const void *extinfo);
 
 #ifdef __cplusplus
 }